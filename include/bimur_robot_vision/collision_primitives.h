@@ -0,0 +1,92 @@
+/*
+	Cheap collision shapes for detected objects.
+
+	Every accepted cluster is approximated by a box or, when its footprint is
+	round, an upright cylinder standing on the table. The orientation comes
+	from the covariance kept by the clustering, the extents from one pass
+	over the returned points. A tracker gives the shapes ids that stay the
+	same across detections, so a planning scene can be updated in place.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_COLLISION_PRIMITIVES_H
+#define BIMUR_ROBOT_VISION_COLLISION_PRIMITIVES_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "bimur_robot_vision/tabletop_detector.h"
+
+namespace bimur_robot_vision
+{
+
+enum PrimitiveType
+{
+	PRIMITIVE_BOX,
+	PRIMITIVE_CYLINDER
+};
+
+struct ObjectPrimitive
+{
+	//assigned by PrimitiveTracker, -1 until then
+	int id;
+
+	//index of the cluster in TabletopResult::clusters
+	size_t cluster;
+
+	PrimitiveType type;
+
+	//centre of the shape and its axes (x, y along the table, z up), in the frame of the cloud
+	Eigen::Vector3f centre;
+	Eigen::Quaternionf orientation;
+
+	//box: size along x, y, z; cylinder: height, radius (as shape_msgs/SolidPrimitive)
+	Eigen::Vector3f dimensions;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+typedef std::vector<ObjectPrimitive, Eigen::aligned_allocator<ObjectPrimitive> > ObjectPrimitives;
+
+/*
+	Function: fitPrimitives()
+	Inputs  : const TabletopResult&, float, ObjectPrimitives&
+	Outputs : None
+	Purpose : one shape per accepted cluster; clusters whose footprint has a
+	          minor to major spread ratio of at least roundness become cylinders
+*/
+void fitPrimitives(const TabletopResult &result, float roundness, ObjectPrimitives &out);
+
+class PrimitiveTracker
+{
+public:
+	/* shapes whose centres moved less than match_distance keep their id */
+	explicit PrimitiveTracker(float match_distance);
+
+	/*
+		Assigns ids to the shapes of a new detection, nearest pairs first, and
+		lists the ids of the shapes that were not seen again.
+	*/
+	void update(ObjectPrimitives &primitives, std::vector<int> &removed);
+
+	/*
+		As update(), for a detection that may have left objects out (top-K,
+		no plane): shapes that were not seen again keep their tracks.
+	*/
+	void match(ObjectPrimitives &primitives);
+
+	void clear();
+
+private:
+	void assign(ObjectPrimitives &primitives, std::vector<char> &track_used) const;
+
+	float match_distance_;
+	int next_id_;
+	std::vector<int> ids_;
+	std::vector<Eigen::Vector3f> centres_;
+};
+
+}
+
+#endif
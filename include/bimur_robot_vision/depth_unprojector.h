@@ -0,0 +1,66 @@
+/*
+	Depth image to point cloud conversion with a cached ray table.
+
+	The ray of every pixel (undistorted, scaled to z = 1) is computed once
+	per camera model and kept; a frame is then unprojected with one multiply
+	per coordinate and pixel, fused with the z limits and region of interest
+	of the pipeline, so that culled pixels never become points.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_DEPTH_UNPROJECTOR_H
+#define BIMUR_ROBOT_VISION_DEPTH_UNPROJECTOR_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "bimur_robot_vision/frame_history.h"
+
+namespace bimur_robot_vision
+{
+
+class DepthUnprojector
+{
+public:
+	typedef pcl::PointXYZRGB PointT;
+	typedef pcl::PointCloud<PointT> PointCloudT;
+
+	DepthUnprojector();
+
+	/*
+		Sets the camera model; distortion holds plumb_bob coefficients (k1,
+		k2, p1, p2, k3) and may be empty. The ray table is only rebuilt when
+		the model differs from the current one; returns true if it was.
+	*/
+	bool setCamera(const CameraIntrinsics &intrinsics, const std::vector<double> &distortion);
+	const CameraIntrinsics &intrinsics() const { return intrinsics_; }
+
+	/* keeps the points with lo <= xyz <= hi, in the camera frame */
+	void setLimits(const float lo[3], const float hi[3]);
+
+	/*
+		Unprojects a 16-bit depth image (depth_scale metres per unit, 0.001
+		for millimetres) into out, as an unorganized cloud of the kept
+		points. rgb is optional, 3 bytes per pixel in r, g, b order; steps are
+		in bytes. Returns false if the image does not match the camera.
+	*/
+	bool unproject(const uint16_t *depth, size_t depth_step, const uint8_t *rgb, size_t rgb_step,
+	               uint32_t width, uint32_t height, float depth_scale, PointCloudT &out) const;
+
+private:
+	CameraIntrinsics intrinsics_;
+	std::vector<double> distortion_;
+	float lo_[3];
+	float hi_[3];
+
+	//ray of every pixel, row-major
+	std::vector<float> ray_x_;
+	std::vector<float> ray_y_;
+};
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+/*
+	History of detection results, without any points.
+
+	Every detection is reduced to its stamp, plane and one summary per
+	object (tracker id, shape, cluster size, centroid and mean colour).
+	Detections and objects are kept column by column in two bounded rings;
+	the stamps are stored back to back in time order, so a time range is
+	found with a binary search and read without touching anything else.
+	Summaries can also be appended to a file as they are added, which
+	keeps the whole history after it has left memory.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_DETECTION_HISTORY_H
+#define BIMUR_ROBOT_VISION_DETECTION_HISTORY_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bimur_robot_vision/collision_primitives.h"
+#include "bimur_robot_vision/tabletop_detector.h"
+
+namespace bimur_robot_vision
+{
+
+struct ObjectSummary
+{
+	//tracker id, -1 if the object was not tracked
+	int id;
+	PrimitiveType type;
+
+	//number of voxels of the cluster
+	uint32_t points;
+
+	float centroid[3];
+
+	//as ObjectPrimitive::dimensions, the last one is 0 for cylinders
+	float dimensions[3];
+
+	//mean colour, packed as in pcl::PointXYZRGB
+	uint32_t rgb;
+};
+
+struct DetectionSummary
+{
+	//microseconds, as pcl::PCLHeader
+	uint64_t stamp;
+	bool is_plane_found;
+	float plane[4];
+	std::vector<ObjectSummary> objects;
+};
+
+/*
+	Function: summarizeDetection()
+	Inputs  : const TabletopResult&, const ObjectPrimitives&, uint64_t, DetectionSummary&
+	Outputs : None
+	Purpose : one object summary per shape fitted to the result
+*/
+void summarizeDetection(const TabletopResult &result, const ObjectPrimitives &primitives, uint64_t stamp,
+                        DetectionSummary &out);
+
+class DetectionHistory
+{
+public:
+	DetectionHistory();
+	~DetectionHistory();
+
+	/* changing the capacity drops the stored detections */
+	void setCapacity(size_t detections, size_t objects);
+	size_t capacity() const { return stamps_.size(); }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	void clear();
+
+	/*
+		Appends every summary added from now on to the file at path, after
+		the summaries already in it; an empty path stops spilling. Returns
+		false if the file cannot be opened or is not a history file. The
+		objects go to a second file, path + ".objects". A record torn by a
+		crash is cut off when the files are opened again.
+	*/
+	bool spillTo(const std::string &path);
+	const std::string &spillPath() const { return spill_path_; }
+
+	/*
+		Adds a detection, dropping the oldest ones until it fits. Detections
+		must come in time order; returns false for one older than the newest.
+		Whether it also reached the spill file is told by lastSpilled().
+	*/
+	bool add(const DetectionSummary &summary);
+
+	/*
+		False if the last detection added was not written to the spill file:
+		it was older than the newest one in the file, or writing failed, in
+		which case spilling stops.
+	*/
+	bool lastSpilled() const { return last_spilled_; }
+
+	/* indices [first, last) of the detections stamped within [begin, end]; 0 is the oldest */
+	void range(uint64_t begin, uint64_t end, size_t &first, size_t &last) const;
+
+	uint64_t stamp(size_t i) const { return stamps_[slot(i)]; }
+	bool isPlaneFound(size_t i) const { return plane_found_[slot(i)] != 0; }
+	const float *plane(size_t i) const { return &planes_[4 * slot(i)]; }
+	size_t numObjects(size_t i) const { return object_counts_[slot(i)]; }
+	ObjectSummary object(size_t i, size_t j) const;
+
+	/* detection i with its objects */
+	void get(size_t i, DetectionSummary &out) const;
+
+	/*
+		Reads the detections stamped within [begin, end] from a spill file,
+		oldest first, at most max of them (0 for all). The records are in
+		time order and of fixed size, so the first one is found with a
+		binary search. Returns false if the files cannot be read.
+	*/
+	static bool readSpilled(const std::string &path, uint64_t begin, uint64_t end, size_t max,
+	                        std::vector<DetectionSummary> &out);
+
+private:
+	size_t slot(size_t i) const { return (head_ + i) % stamps_.size(); }
+	void dropOldest();
+	bool spill(const DetectionSummary &summary);
+	void closeSpill();
+
+	//detection columns, head_ is the oldest
+	std::vector<uint64_t> stamps_;
+	std::vector<uint8_t> plane_found_;
+	std::vector<float> planes_;
+	std::vector<uint64_t> object_begins_;
+	std::vector<uint32_t> object_counts_;
+	size_t head_;
+	size_t size_;
+
+	//object columns, indexed by a running object number modulo their capacity
+	std::vector<int32_t> object_ids_;
+	std::vector<uint8_t> object_types_;
+	std::vector<uint32_t> object_points_;
+	std::vector<float> object_centroids_;
+	std::vector<float> object_dimensions_;
+	std::vector<uint32_t> object_rgb_;
+	uint64_t objects_begin_;
+	uint64_t objects_end_;
+
+	//spill files: fixed-size detection records, and the objects they point to
+	FILE *spill_records_;
+	FILE *spill_objects_;
+	std::string spill_path_;
+	uint64_t spill_objects_end_;
+	uint64_t spill_stamp_;
+	bool last_spilled_;
+
+	DetectionHistory(const DetectionHistory &);
+	DetectionHistory &operator=(const DetectionHistory &);
+};
+
+}
+
+#endif
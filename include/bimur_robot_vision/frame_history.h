@@ -0,0 +1,97 @@
+/*
+	Ring buffer of recent input frames in a compact encoding.
+
+	Organized frames are stored as 16-bit depth (mm) plus 24-bit colour per
+	pixel, with pinhole intrinsics estimated once from the cloud and shared by
+	all frames of the same size. Frames that do not fit a pinhole model fall
+	back to 16-bit quantized xyz plus colour per point. Either way a frame
+	costs 5 or 9 bytes per point instead of 32, and is unprojected back to
+	PointXYZRGB only when asked for.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_FRAME_HISTORY_H
+#define BIMUR_ROBOT_VISION_FRAME_HISTORY_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace bimur_robot_vision
+{
+
+struct CameraIntrinsics
+{
+	float fx, fy, cx, cy;
+	uint32_t width, height;
+	bool valid;
+
+	CameraIntrinsics() : fx(0), fy(0), cx(0), cy(0), width(0), height(0), valid(false) {}
+};
+
+struct EncodedFrame
+{
+	uint32_t seq;
+	uint64_t stamp;
+	std::string frame_id;
+	uint32_t width, height;
+
+	//true: depth holds one value per pixel and shares the history intrinsics
+	bool pinhole;
+	std::vector<uint16_t> depth;
+	std::vector<int16_t> xyz;
+	std::vector<uint8_t> rgb;
+
+	size_t size() const { return (size_t)width * height; }
+	size_t memoryUsage() const;
+};
+
+class FrameHistory
+{
+public:
+	typedef pcl::PointXYZRGB PointT;
+	typedef pcl::PointCloud<PointT> PointCloudT;
+
+	explicit FrameHistory(size_t capacity);
+
+	/* changing the capacity drops the stored frames */
+	void setCapacity(size_t capacity);
+	size_t capacity() const { return ring_.size(); }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	void clear();
+
+	/* encodes a frame, overwriting the oldest one when full */
+	void push(const PointCloudT &frame);
+
+	/* i = 0 is the newest frame */
+	const EncodedFrame &frame(size_t i) const;
+
+	/* unprojects frame i into out, replacing its contents; points without depth are left out */
+	void decode(size_t i, PointCloudT &out) const;
+
+	const CameraIntrinsics &intrinsics() const { return intrinsics_; }
+	size_t memoryUsage() const;
+
+private:
+	bool estimateIntrinsics(const PointCloudT &frame, CameraIntrinsics &out) const;
+	bool checkIntrinsics(const PointCloudT &frame, const CameraIntrinsics &intrinsics) const;
+	void setIntrinsics(const CameraIntrinsics &intrinsics);
+	void encodePinhole(const PointCloudT &frame, EncodedFrame &out) const;
+	void encodePoints(const PointCloudT &frame, EncodedFrame &out) const;
+
+	std::vector<EncodedFrame> ring_;
+	size_t head_;
+	size_t size_;
+
+	CameraIntrinsics intrinsics_;
+	//(u - cx) / fx per column and (v - cy) / fy per row
+	std::vector<float> col_ray_;
+	std::vector<float> row_ray_;
+};
+
+}
+
+#endif
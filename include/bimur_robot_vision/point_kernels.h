@@ -0,0 +1,78 @@
+/*
+	Per-point kernels used by every stage of the pipeline (z/ROI culling,
+	plane distances, bounding boxes, colour sums, RGB unpacking, rigid
+	transforms, depth unprojection).
+
+	Each kernel has a scalar reference implementation and, on x86, SSE4.2,
+	AVX2 and AVX-512 implementations. The best set the CPU supports is picked
+	once, on first use; the BIMUR_VISION_KERNELS environment variable
+	(scalar, sse42, avx2, avx512) overrides the choice.
+
+	Points are pcl::PointXYZRGB (32 bytes, 16-byte aligned). The culling
+	kernel rejects non-finite points, the others expect finite ones.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_POINT_KERNELS_H
+#define BIMUR_ROBOT_VISION_POINT_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pcl/point_types.h>
+
+namespace bimur_robot_vision
+{
+
+struct PointKernels
+{
+	const char *name;
+
+	/* closest and furthest |ax + by + cz + d| / |(a, b, c)| over the points */
+	void (*plane_distance_range)(const pcl::PointXYZRGB *points, size_t size, const float plane[4],
+	                             float *min_distance, float *max_distance);
+
+	/* axis aligned bounds; min = +FLT_MAX, max = -FLT_MAX for no points */
+	void (*bounding_box)(const pcl::PointXYZRGB *points, size_t size, float min[3], float max[3]);
+
+	/* sums of the r, g and b channels */
+	void (*colour_sums)(const pcl::PointXYZRGB *points, size_t size, uint64_t sums[3]);
+
+	/*
+		copies the points with lo <= xyz <= hi to out, keeping their order, and
+		returns how many were copied. out may alias points.
+	*/
+	size_t (*crop)(const pcl::PointXYZRGB *points, size_t size, const float lo[3], const float hi[3],
+	               pcl::PointXYZRGB *out);
+
+	/* unpacks the packed colour into 3 bytes (r, g, b) per point */
+	void (*unpack_rgb)(const pcl::PointXYZRGB *points, size_t size, uint8_t *rgb);
+
+	/*
+		copies the points to out with xyz replaced by R * xyz + t, where matrix
+		is [R | t] row by row; colours are kept. out may alias points.
+	*/
+	void (*transform)(const pcl::PointXYZRGB *points, size_t size, const float matrix[12],
+	                  pcl::PointXYZRGB *out);
+
+	/*
+		unprojects depth pixels to depth * scale * (ray_x, ray_y, 1), copies
+		the points with lo <= xyz <= hi to out, with their colour (3 bytes r,
+		g, b per pixel, or black for NULL), and returns how many were copied.
+		Pixels without depth (0) are always dropped.
+	*/
+	size_t (*unproject)(const uint16_t *depth, const float *ray_x, const float *ray_y, size_t size, float scale,
+	                    const uint8_t *rgb, const float lo[3], const float hi[3], pcl::PointXYZRGB *out);
+};
+
+/* the kernels for this CPU */
+const PointKernels &pointKernels();
+
+/* the scalar reference kernels */
+const PointKernels &scalarPointKernels();
+
+/* kernels by name ("scalar", "sse42", "avx2", "avx512"); NULL if this CPU or build lacks them */
+const PointKernels *pointKernelsByName(const char *name);
+
+}
+
+#endif
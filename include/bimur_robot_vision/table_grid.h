@@ -0,0 +1,101 @@
+/*
+	Occupancy grid of the table top, in a frame lying in the table plane.
+
+	Cells holding table points are free, cells under anything above the
+	table are occupied, everything else (off the table, never seen) is
+	unknown. Placement queries are answered from the grid alone: a distance
+	transform over the free cells gives the widest free disc around every
+	cell, without going back to the points.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_TABLE_GRID_H
+#define BIMUR_ROBOT_VISION_TABLE_GRID_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <Eigen/Core>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace bimur_robot_vision
+{
+
+/* a free spot on the table */
+struct Placement
+{
+	//centre along the grid axes, and in the frame of the cloud
+	Eigen::Vector2f position;
+	Eigen::Vector3f point;
+
+	//distance from the centre to the nearest occupied or unknown cell
+	float clearance;
+};
+
+class TableGrid
+{
+public:
+	typedef pcl::PointXYZRGB PointT;
+	typedef pcl::PointCloud<PointT> PointCloudT;
+
+	//cell values, as in nav_msgs/OccupancyGrid
+	static const int8_t UNKNOWN = -1;
+	static const int8_t FREE = 0;
+	static const int8_t OCCUPIED = 100;
+
+	TableGrid();
+
+	void clear();
+	bool empty() const { return cells_.empty(); }
+
+	/*
+		Lays the grid over the table points (the plane inliers of cloud) and
+		marks their cells free. The grid normal is turned towards the origin
+		of the cloud, i.e. up for a sensor looking down at the table.
+	*/
+	void build(const PointCloudT &cloud, const std::vector<int> &indices, const Eigen::Vector4f &plane,
+	           float resolution);
+
+	/* marks the cells under the points at least min_height above the table as occupied */
+	void addObstacles(const PointT *points, size_t size, float min_height);
+
+	/*
+		Centres where a disc of the given radius fits on free cells, widest
+		first and at least two radii apart; at most max_placements of them.
+	*/
+	void findPlacements(float radius, int max_placements, std::vector<Placement> &out) const;
+
+	float resolution() const { return resolution_; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+
+	/* row-major, x along the first axis */
+	const std::vector<int8_t> &cells() const { return cells_; }
+
+	/* corner of cell (0, 0) and the grid axes (x, y, normal) as columns, in the frame of the cloud */
+	const Eigen::Vector3f &origin() const { return origin_; }
+	const Eigen::Matrix3f &axes() const { return axes_; }
+
+	/* height of a point above the table */
+	float heightOf(const Eigen::Vector3f &p) const { return axes_.col(2).dot(p) + offset_; }
+
+	/* centre of a cell in the frame of the cloud */
+	Eigen::Vector3f cellCentre(int x, int y) const;
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+private:
+	float resolution_;
+	int width_;
+	int height_;
+	Eigen::Vector3f origin_;
+	Eigen::Matrix3f axes_;
+	float offset_;
+	std::vector<int8_t> cells_;
+};
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+/*
+	Quick check of what stands on a known table.
+
+	Answers "is the table empty" and "how many objects are on it" from a
+	single frame and the table grid of an earlier detection: one pass bins
+	the points above the table by height and into coarse table cells, and
+	the connected groups of occupied cells are counted as objects. No voxel
+	grid, plane fit or clustering runs.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_TABLE_PRESENCE_H
+#define BIMUR_ROBOT_VISION_TABLE_PRESENCE_H
+
+#include <vector>
+#include <stddef.h>
+
+#include <pcl/point_types.h>
+
+#include "bimur_robot_vision/table_grid.h"
+
+namespace bimur_robot_vision
+{
+
+struct PresenceParams
+{
+	//points between these heights above the table are considered
+	float min_height;
+	float max_height;
+
+	//bin size of the height histogram
+	float histogram_bin;
+
+	//size of the coarse cells, and the points a cell or an object needs to count
+	float cell_size;
+	int min_cell_points;
+	int min_object_points;
+
+	PresenceParams();
+};
+
+struct PresenceResult
+{
+	//points above the table (within the table's footprint)
+	size_t num_points_above;
+
+	//points per height bin, from min_height up
+	std::vector<int> height_histogram;
+
+	//points of each object found, largest first
+	std::vector<int> object_points;
+
+	size_t numObjects() const { return object_points.size(); }
+	bool empty() const { return object_points.empty(); }
+};
+
+class TablePresence
+{
+public:
+	typedef pcl::PointXYZRGB PointT;
+
+	explicit TablePresence(const PresenceParams &params = PresenceParams());
+
+	const PresenceParams &params() const { return params_; }
+	void setParams(const PresenceParams &params) { params_ = params; }
+
+	/* counts the objects in the points that stand on the cells of table */
+	void count(const PointT *points, size_t size, const TableGrid &table, PresenceResult &result);
+
+private:
+	PresenceParams params_;
+
+	//per-call scratch buffers, kept to avoid reallocating
+	std::vector<int> cell_points_;
+	std::vector<int> labels_;
+	std::vector<int> stack_;
+};
+
+}
+
+#endif
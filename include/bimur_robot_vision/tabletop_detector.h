@@ -0,0 +1,231 @@
+/*
+	In-process tabletop detection.
+
+	The same pipeline the object_detection_node service runs (z filter, voxel
+	grid, RANSAC plane, euclidean clustering, plane distance check), without
+	any ROS dependency, so that other nodes can link it and call it directly.
+
+	A TabletopDetector keeps state across frames (incremental clustering) and
+	is not thread safe; use one detector per thread. Results are written to a
+	caller-provided TabletopResult whose buffers are reused across calls.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_TABLETOP_DETECTOR_H
+#define BIMUR_ROBOT_VISION_TABLETOP_DETECTOR_H
+
+#include <vector>
+#include <stddef.h>
+
+#include <Eigen/Core>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "bimur_robot_vision/voxel_clustering.h"
+#include "bimur_robot_vision/voxel_raw_map.h"
+#include "bimur_robot_vision/table_grid.h"
+
+namespace bimur_robot_vision
+{
+
+struct DetectorParams
+{
+	//z limits and x/y region of interest of the input, in the frame of the cloud
+	float z_min;
+	float z_max;
+	float x_min;
+	float x_max;
+	float y_min;
+	float y_max;
+
+	//leaf size of the voxel grid filter
+	float leaf_size;
+
+	//RANSAC plane fitting
+	int plane_max_iterations;
+	float plane_distance_threshold;
+
+	//euclidean clustering
+	float cluster_tolerance;
+	int min_cluster_size;
+	int max_cluster_size;
+	bool incremental_clustering;
+
+	//an object whose closest point to the plane is further than this is rejected
+	double plane_distance_tolerance;
+
+	DetectorParams();
+};
+
+enum RankBy
+{
+	RANK_BY_SIZE,
+	RANK_BY_DISTANCE,
+	RANK_BY_HEIGHT
+};
+
+struct DetectOptions
+{
+	//return the raw points of the accepted clusters instead of their voxels
+	bool full_resolution;
+
+	//only accept the max_objects best ranked clusters, 0 accepts all
+	int max_objects;
+	RankBy rank_by;
+	Eigen::Vector3f reference_point;
+
+	//cell size of the table occupancy grid, 0 does not build it
+	float table_grid_resolution;
+
+	//order the points of each accepted cluster into levels of detail;
+	//without it every level is the whole cluster
+	bool levels_of_detail;
+
+	DetectOptions();
+};
+
+/* a frame that is only read, e.g. a PointCloud or a wrapped external buffer */
+struct FrameView
+{
+	const pcl::PointXYZRGB *points;
+	size_t size;
+	pcl::PCLHeader header;
+
+	FrameView() : points(NULL), size(0) {}
+	FrameView(const pcl::PointXYZRGB *p, size_t n) : points(p), size(n) {}
+};
+
+/*
+	Levels of the per-cluster level-of-detail pyramid. Level 0 is every
+	returned point, level l keeps one point per cell of leaf_size * 2^l.
+*/
+static const int LOD_LEVELS = 6;
+
+/*
+	An accepted cluster, stored in TabletopResult::cluster_points. With
+	DetectOptions::levels_of_detail its points are ordered coarse to fine,
+	so that each level of detail is a prefix.
+*/
+struct ClusterView
+{
+	size_t offset;
+	size_t size;
+	//number of points in each level of detail, lod_size[0] == size
+	size_t lod_size[LOD_LEVELS];
+	ClusterAggregate aggregate;
+	double min_plane_distance;
+	double max_plane_distance;
+
+	//mean colour of the returned points (raw points in full resolution mode)
+	Eigen::Vector3f mean_rgb;
+
+	/*
+		number of leading points to return for a level of detail, or for the
+		finest level with at most max_points points; 0 means no limit
+	*/
+	size_t lodPrefix(int level, int max_points) const;
+};
+
+struct TabletopResult
+{
+	typedef pcl::PointXYZRGB PointT;
+	typedef pcl::PointCloud<PointT> PointCloudT;
+
+	bool is_plane_found;
+
+	//coefficients as reported by the service (offset for the crop box)
+	Eigen::Vector4f plane_coefficients;
+	//plane model as fitted by RANSAC
+	Eigen::Vector4f plane_model;
+
+	PointCloudT plane;
+	PointCloudT blobs;
+
+	//points of all accepted clusters, back to back
+	PointCloudT cluster_points;
+	std::vector<ClusterView> clusters;
+
+	//free and occupied table cells, if asked for
+	TableGrid table_grid;
+
+	//statistics
+	size_t num_filtered;
+	size_t num_candidates;
+
+	//pointer arithmetic, as an empty cluster at the end has offset == points.size()
+	const PointT *clusterBegin(size_t i) const { return cluster_points.points.data() + clusters[i].offset; }
+	const PointT *clusterEnd(size_t i) const { return clusterBegin(i) + clusters[i].size; }
+
+	TabletopResult() { clear(); }
+	void clear();
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+class TabletopDetector
+{
+public:
+	typedef pcl::PointXYZRGB PointT;
+	typedef pcl::PointCloud<PointT> PointCloudT;
+
+	explicit TabletopDetector(const DetectorParams &params = DetectorParams());
+
+	const DetectorParams &params() const { return params_; }
+	/* changing the clustering parameters drops the incremental state */
+	void setParams(const DetectorParams &params);
+
+	/*
+		Runs the pipeline on one (possibly aggregated) frame. Returns false if
+		the input was empty; a frame without a plane returns true with
+		result.is_plane_found unset.
+	*/
+	bool detect(const FrameView &frame, const DetectOptions &options, TabletopResult &result);
+	bool detect(const PointCloudT &frame, const DetectOptions &options, TabletopResult &result);
+
+	/* voxel clustering state, for diagnostics */
+	const IncrementalVoxelClustering &clustering() const { return clustering_; }
+
+private:
+	struct Candidate
+	{
+		ClusterAggregate aggregate;
+		int id;
+		PointCloudT::Ptr points;
+		double score;
+	};
+
+	static bool worseCandidate(const Candidate &a, const Candidate &b);
+
+	void computeClusters(const PointCloudT &in);
+	const PointCloudT &gatherCandidate(Candidate &c);
+	double rankCandidate(const Candidate &c, const DetectOptions &options, const Eigen::Vector4f &plane) const;
+	void orderLevelsOfDetail(PointT *points, size_t size, size_t *lod_size);
+
+	DetectorParams params_;
+
+	IncrementalVoxelClustering clustering_;
+	VoxelRawMap raw_map_;
+
+	//per-call scratch buffers, kept to avoid reallocating
+	PointCloudT::Ptr cloud_;
+	PointCloudT::Ptr cloud_filtered_;
+	PointCloudT gathered_;
+	std::vector<Candidate> candidates_;
+	std::vector<int> lod_level_;
+	std::vector<size_t> lod_order_;
+	std::vector<PointT, Eigen::aligned_allocator<PointT> > lod_points_;
+	boost::unordered_map<VoxelKey, int> lod_cells_;
+};
+
+/*
+	Function: planeDistanceRange()
+	Inputs  : const PointXYZRGB*, size_t, Eigen::Vector4f, double&, double&
+	Outputs : None
+	Purpose : closest and furthest distance of the points to the plane
+*/
+void planeDistanceRange(const pcl::PointXYZRGB *points, size_t size, const Eigen::Vector4f &plane,
+                        double &min_distance, double &max_distance);
+
+}
+
+#endif
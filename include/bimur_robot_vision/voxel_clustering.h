@@ -0,0 +1,152 @@
+/*
+	Incremental euclidean clustering over a voxel grid.
+
+	The clustering state (a union-find over occupied voxels with per-cluster
+	aggregates) is kept across frames, so that only voxels which appeared or
+	disappeared since the previous frame are processed. Merges are handled by
+	union, splits by re-labelling only the components that lost voxels.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_VOXEL_CLUSTERING_H
+#define BIMUR_ROBOT_VISION_VOXEL_CLUSTERING_H
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+#include <boost/unordered_map.hpp>
+
+#include <Eigen/Core>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace bimur_robot_vision
+{
+
+typedef uint64_t VoxelKey;
+
+/*
+	Function: packVoxelKey()
+	Inputs  : int, int, int
+	Outputs : VoxelKey
+	Purpose : packs integer voxel coordinates (21 bits each) into a hash key
+*/
+inline VoxelKey packVoxelKey(int x, int y, int z){
+	const uint64_t mask = (1u << 21) - 1;
+	return ((uint64_t)(x + (1 << 20)) & mask) << 42 |
+	       ((uint64_t)(y + (1 << 20)) & mask) << 21 |
+	       ((uint64_t)(z + (1 << 20)) & mask);
+}
+
+/*
+	Function: voxelCoord()
+	Inputs  : float, float
+	Outputs : int
+	Purpose : voxel coordinate of a value, aligned the same way as pcl::VoxelGrid
+*/
+inline int voxelCoord(float v, float inverse_leaf){
+	return (int)std::floor(v * inverse_leaf);
+}
+
+/*
+	Per-cluster running sums. Everything except the voxel bounds can be
+	updated in both directions, so a cluster whose voxels merely shift does
+	not need to be revisited.
+*/
+struct ClusterAggregate
+{
+	int count;
+	Eigen::Vector3d sum;
+	Eigen::Matrix3d sum_sq;
+	Eigen::Vector3d sum_rgb;
+	Eigen::Vector3i min_voxel;
+	Eigen::Vector3i max_voxel;
+
+	ClusterAggregate();
+
+	void add(const pcl::PointXYZRGB &p);
+	void remove(const pcl::PointXYZRGB &p);
+	void merge(const ClusterAggregate &other);
+	void expand(const Eigen::Vector3i &voxel);
+
+	Eigen::Vector3f centroid() const;
+	Eigen::Matrix3f covariance() const;
+};
+
+struct VoxelCluster
+{
+	int id;
+	ClusterAggregate aggregate;
+};
+
+class IncrementalVoxelClustering
+{
+public:
+	typedef pcl::PointXYZRGB PointT;
+	typedef pcl::PointCloud<PointT> PointCloudT;
+
+	IncrementalVoxelClustering(float leaf_size, float tolerance);
+
+	/* drops all state, the next update() clusters from scratch */
+	void reset();
+
+	/* changes the connection distance; resets when it differs */
+	void setTolerance(float tolerance);
+	float getTolerance() const { return tolerance_; }
+
+	/*
+		Feeds the voxelized points of a new frame. Voxels are matched to the
+		previous frame by key; only added and removed voxels touch the
+		union-find.
+	*/
+	void update(const PointCloudT &voxels);
+
+	/* lists the current clusters within the size limits, largest first */
+	void clusters(int min_size, int max_size, std::vector<VoxelCluster> &out) const;
+
+	/* appends the points of the cluster with the given id to out */
+	void gather(int id, PointCloudT &out) const;
+
+	/* statistics of the last update() */
+	int numAdded() const { return num_added_; }
+	int numRemoved() const { return num_removed_; }
+	int numVoxels() const { return (int)index_.size(); }
+
+private:
+	int allocSlot(VoxelKey key, const Eigen::Vector3i &voxel, const PointT &p);
+	void freeSlot(int s);
+	int find(int s);
+	void unite(int a, int b);
+	void rebuildComponent(int root);
+	template <typename F> void forEachNeighbour(int s, F f);
+
+	VoxelKey cellKeyOf(const Eigen::Vector3i &voxel) const;
+
+	float leaf_size_;
+	float inverse_leaf_;
+	float tolerance_;
+	int cell_voxels_;
+
+	//slot storage, indexed by slot id
+	std::vector<VoxelKey> keys_;
+	std::vector<Eigen::Vector3i> voxels_;
+	std::vector<PointT, Eigen::aligned_allocator<PointT> > points_;
+	std::vector<int> parent_;
+	std::vector<char> alive_;
+	std::vector<unsigned int> last_seen_;
+	std::vector<std::vector<int> > members_;
+	std::vector<ClusterAggregate> aggregates_;
+	std::vector<int> free_;
+
+	//voxel key -> slot and coarse neighbour cell -> slots
+	boost::unordered_map<VoxelKey, int> index_;
+	boost::unordered_map<VoxelKey, std::vector<int> > cells_;
+
+	unsigned int frame_;
+	int num_added_;
+	int num_removed_;
+};
+
+}
+
+#endif
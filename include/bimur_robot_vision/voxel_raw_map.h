@@ -0,0 +1,51 @@
+/*
+	Mapping from voxel grid cells back to the raw points they were built from.
+
+	Built once from the front-end (pre voxel grid) cloud, it lets the
+	pipeline stay at voxel resolution and only gather the full-resolution
+	points of the clusters that were finally accepted.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_VOXEL_RAW_MAP_H
+#define BIMUR_ROBOT_VISION_VOXEL_RAW_MAP_H
+
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "bimur_robot_vision/voxel_clustering.h"
+
+namespace bimur_robot_vision
+{
+
+class VoxelRawMap
+{
+public:
+	typedef pcl::PointXYZRGB PointT;
+	typedef pcl::PointCloud<PointT> PointCloudT;
+
+	explicit VoxelRawMap(float leaf_size);
+
+	/* indexes the raw points by voxel; keeps a reference to the cloud */
+	void build(const PointCloudT::ConstPtr &raw);
+
+	void clear();
+	bool empty() const { return !raw_; }
+
+	/* appends the raw points of every voxel in voxels to out */
+	void gather(const PointCloudT &voxels, PointCloudT &out) const;
+
+private:
+	float inverse_leaf_;
+	PointCloudT::ConstPtr raw_;
+
+	//voxel key -> (offset, count) into order_, raw point indices grouped by voxel
+	boost::unordered_map<VoxelKey, std::pair<int, int> > ranges_;
+	std::vector<int> order_;
+};
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# Measures startup time (until the services are advertised and the tf
+# listener is up), resident memory and number of loaded shared libraries
+# of an object detection node binary. Needs a running roscore.
+#
+# The end of startup is the wall clock stamp of the node's own "ready" log
+# line, so the time is not rounded up to the polling interval of this script
+# (use_sim_time must be off for the log stamps to be wall clock).
+#
+# usage: measure_startup.sh <node binary> [runs]
+#   e.g. measure_startup.sh devel/lib/bimur_robot_vision/object_detection_node 10
+#        measure_startup.sh devel/lib/bimur_robot_vision/object_detection_node_lean 10
+
+BINARY=$1
+RUNS=${2:-5}
+READY="bimur_object_detector ready"
+
+if [ -z "$BINARY" ] || [ ! -x "$BINARY" ]; then
+	echo "usage: $0 <node binary> [runs]"
+	exit 1
+fi
+
+LOG=$(mktemp)
+trap 'rm -f "$LOG"' EXIT
+
+echo "binary: $BINARY"
+echo "run  startup_ms  rss_kb  hwm_kb  shared_libs"
+
+for run in $(seq 1 $RUNS); do
+	start=$(date +%s%N)
+	#log lines as "<secs>.<nsecs> <message>", stamped with the wall clock
+	ROSCONSOLE_FORMAT='${time} ${message}' ROSCONSOLE_STDOUT_LINE_BUFFERED=1 \
+		"$BINARY" __name:=startup_probe_$run > "$LOG" 2>&1 &
+	pid=$!
+
+	#wait for the ready line (at most 30 s)
+	line=""
+	for i in $(seq 1 3000); do
+		line=$(grep -m 1 "$READY" "$LOG")
+		if [ -n "$line" ]; then
+			break
+		fi
+		sleep 0.01
+	done
+	if [ -z "$line" ]; then
+		echo "$run  no ready line within 30 s"
+		kill -INT $pid
+		wait $pid 2> /dev/null
+		continue
+	fi
+	secs=${line%%.*}
+	nsecs=${line#*.}
+	nsecs=${nsecs%% *}
+	ready=$(( secs * 1000000000 + 10#$nsecs ))
+
+	rss=$(awk '/VmRSS/ {print $2}' /proc/$pid/status)
+	hwm=$(awk '/VmHWM/ {print $2}' /proc/$pid/status)
+	libs=$(grep -o '/[^ ]*\.so[^ ]*' /proc/$pid/maps | sort -u | wc -l)
+
+	echo "$run  $(( (ready - start) / 1000000 ))  $rss  $hwm  $libs"
+
+	kill -INT $pid
+	wait $pid 2> /dev/null
+	#let the master drop the services before the next run
+	sleep 1
+done
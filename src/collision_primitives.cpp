@@ -0,0 +1,184 @@
+/*
+	Cheap collision shapes for detected objects, see collision_primitives.h
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <Eigen/Eigenvalues>
+
+#include "bimur_robot_vision/collision_primitives.h"
+
+namespace bimur_robot_vision
+{
+
+void fitPrimitives(const TabletopResult &result, float roundness, ObjectPrimitives &out){
+	out.clear();
+	if (!result.is_plane_found)
+		return;
+
+	//unit normal pointing away from the table, towards the sensor
+	Eigen::Vector3f n = result.plane_model.head<3>();
+	float norm = n.norm();
+	n /= norm;
+	float d = result.plane_model(3) / norm;
+	if (d < 0.0f){
+		n = -n;
+		d = -d;
+	}
+
+	//any basis of the plane, the footprint axes are found in it
+	Eigen::Vector3f u = n.unitOrthogonal();
+	Eigen::Vector3f v = n.cross(u);
+	Eigen::Matrix<float, 3, 2> basis;
+	basis.col(0) = u;
+	basis.col(1) = v;
+
+	for (size_t i = 0; i < result.clusters.size(); i++){
+		const ClusterView &view = result.clusters[i];
+		if (view.size == 0)
+			continue;
+
+		//spread of the cluster along the table, from the clustering aggregates
+		Eigen::Vector3f centroid = view.aggregate.centroid();
+		Eigen::Matrix2f footprint = basis.transpose() * view.aggregate.covariance() * basis;
+		Eigen::SelfAdjointEigenSolver<Eigen::Matrix2f> solver(footprint);
+		Eigen::Vector2f major2 = solver.eigenvectors().col(1);
+		Eigen::Vector3f major = (basis * major2).normalized();
+		Eigen::Vector3f minor = n.cross(major);
+		float spread_ratio = std::sqrt(std::max(solver.eigenvalues()(0), 0.0f) /
+		                               std::max(solver.eigenvalues()(1), FLT_MIN));
+
+		//extents along the axes; objects stand on the table, so shapes reach down to it
+		float lo[2] = {FLT_MAX, FLT_MAX};
+		float hi[2] = {-FLT_MAX, -FLT_MAX};
+		float top = 0.0f;
+		const TabletopResult::PointT *points = result.clusterBegin(i);
+		for (size_t j = 0; j < view.size; j++){
+			Eigen::Vector3f p(points[j].x, points[j].y, points[j].z);
+			Eigen::Vector3f q = p - centroid;
+			float a = major.dot(q), b = minor.dot(q);
+			lo[0] = std::min(lo[0], a); hi[0] = std::max(hi[0], a);
+			lo[1] = std::min(lo[1], b); hi[1] = std::max(hi[1], b);
+			top = std::max(top, n.dot(p) + d);
+		}
+
+		Eigen::Vector3f middle = centroid + major * (0.5f * (lo[0] + hi[0])) + minor * (0.5f * (lo[1] + hi[1]));
+		Eigen::Vector3f base = middle - n * (n.dot(middle) + d);
+
+		Eigen::Matrix3f axes;
+		axes.col(0) = major;
+		axes.col(1) = minor;
+		axes.col(2) = n;
+
+		ObjectPrimitive primitive;
+		primitive.id = -1;
+		primitive.cluster = i;
+		primitive.centre = base + n * (0.5f * top);
+		primitive.orientation = Eigen::Quaternionf(axes);
+
+		if (spread_ratio >= roundness){
+			float radius_sq = 0.0f;
+			for (size_t j = 0; j < view.size; j++){
+				Eigen::Vector3f q = Eigen::Vector3f(points[j].x, points[j].y, points[j].z) - base;
+				radius_sq = std::max(radius_sq, (q - n * n.dot(q)).squaredNorm());
+			}
+			primitive.type = PRIMITIVE_CYLINDER;
+			primitive.dimensions = Eigen::Vector3f(top, std::sqrt(radius_sq), 0.0f);
+		} else {
+			primitive.type = PRIMITIVE_BOX;
+			primitive.dimensions = Eigen::Vector3f(hi[0] - lo[0], hi[1] - lo[1], top);
+		}
+		out.push_back(primitive);
+	}
+}
+
+
+PrimitiveTracker::PrimitiveTracker(float match_distance)
+	: match_distance_(match_distance),
+	  next_id_(0)
+{
+}
+
+void PrimitiveTracker::clear(){
+	ids_.clear();
+	centres_.clear();
+}
+
+/*
+	Function: assign()
+	Inputs  : ObjectPrimitives&, std::vector<char>&
+	Outputs : None
+	Purpose : gives shapes the ids of the tracked shapes nearest to them,
+	          nearest pairs first, and flags the tracks that were matched;
+	          unmatched shapes get -1
+*/
+void PrimitiveTracker::assign(ObjectPrimitives &primitives, std::vector<char> &track_used) const {
+	//every close enough (previous, new) pair, nearest first
+	std::vector<std::pair<float, std::pair<int, int> > > pairs;
+	const float match_sq = match_distance_ * match_distance_;
+	for (size_t t = 0; t < centres_.size(); t++){
+		for (size_t p = 0; p < primitives.size(); p++){
+			float distance_sq = (centres_[t] - primitives[p].centre).squaredNorm();
+			if (distance_sq <= match_sq)
+				pairs.push_back(std::make_pair(distance_sq, std::make_pair((int)t, (int)p)));
+		}
+	}
+	std::sort(pairs.begin(), pairs.end());
+
+	track_used.assign(centres_.size(), 0);
+	for (size_t p = 0; p < primitives.size(); p++)
+		primitives[p].id = -1;
+	for (size_t i = 0; i < pairs.size(); i++){
+		int t = pairs[i].second.first;
+		int p = pairs[i].second.second;
+		if (track_used[t] || primitives[p].id >= 0)
+			continue;
+		track_used[t] = 1;
+		primitives[p].id = ids_[t];
+	}
+}
+
+void PrimitiveTracker::update(ObjectPrimitives &primitives, std::vector<int> &removed){
+	removed.clear();
+	std::vector<char> track_used;
+	assign(primitives, track_used);
+
+	for (size_t t = 0; t < centres_.size(); t++){
+		if (!track_used[t])
+			removed.push_back(ids_[t]);
+	}
+
+	ids_.resize(primitives.size());
+	centres_.resize(primitives.size());
+	for (size_t p = 0; p < primitives.size(); p++){
+		if (primitives[p].id < 0)
+			primitives[p].id = next_id_++;
+		ids_[p] = primitives[p].id;
+		centres_[p] = primitives[p].centre;
+	}
+}
+
+void PrimitiveTracker::match(ObjectPrimitives &primitives){
+	std::vector<char> track_used;
+	assign(primitives, track_used);
+
+	//matched tracks follow their shapes, new shapes start tracks, the rest are kept
+	for (size_t p = 0; p < primitives.size(); p++){
+		if (primitives[p].id < 0){
+			primitives[p].id = next_id_++;
+			ids_.push_back(primitives[p].id);
+			centres_.push_back(primitives[p].centre);
+			continue;
+		}
+		for (size_t t = 0; t < ids_.size(); t++){
+			if (ids_[t] == primitives[p].id){
+				centres_[t] = primitives[p].centre;
+				break;
+			}
+		}
+	}
+}
+
+}
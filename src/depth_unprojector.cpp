@@ -0,0 +1,93 @@
+/*
+	Depth image to point cloud conversion, see depth_unprojector.h
+*/
+
+#include <cfloat>
+#include <cstring>
+
+#include "bimur_robot_vision/depth_unprojector.h"
+#include "bimur_robot_vision/point_kernels.h"
+
+namespace bimur_robot_vision
+{
+
+DepthUnprojector::DepthUnprojector(){
+	lo_[0] = lo_[1] = lo_[2] = -FLT_MAX;
+	hi_[0] = hi_[1] = hi_[2] = FLT_MAX;
+}
+
+bool DepthUnprojector::setCamera(const CameraIntrinsics &intrinsics, const std::vector<double> &distortion){
+	if (intrinsics_.valid && intrinsics.fx == intrinsics_.fx && intrinsics.fy == intrinsics_.fy &&
+	    intrinsics.cx == intrinsics_.cx && intrinsics.cy == intrinsics_.cy &&
+	    intrinsics.width == intrinsics_.width && intrinsics.height == intrinsics_.height &&
+	    distortion == distortion_)
+		return false;
+
+	intrinsics_ = intrinsics;
+	intrinsics_.valid = true;
+	distortion_ = distortion;
+
+	double k[5] = {0, 0, 0, 0, 0};
+	for (size_t i = 0; i < distortion.size() && i < 5; i++)
+		k[i] = distortion[i];
+	bool distorted = k[0] != 0 || k[1] != 0 || k[2] != 0 || k[3] != 0 || k[4] != 0;
+
+	size_t size = (size_t)intrinsics.width * intrinsics.height;
+	ray_x_.resize(size);
+	ray_y_.resize(size);
+	for (uint32_t v = 0; v < intrinsics.height; v++){
+		for (uint32_t u = 0; u < intrinsics.width; u++){
+			double xd = (u - intrinsics.cx) / intrinsics.fx;
+			double yd = (v - intrinsics.cy) / intrinsics.fy;
+			double x = xd, y = yd;
+
+			//invert the plumb_bob model by fixed point iteration, as OpenCV does
+			for (int it = 0; distorted && it < 10; it++){
+				double r2 = x * x + y * y;
+				double radial = 1.0 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2;
+				double dx = 2.0 * k[2] * x * y + k[3] * (r2 + 2.0 * x * x);
+				double dy = k[2] * (r2 + 2.0 * y * y) + 2.0 * k[3] * x * y;
+				x = (xd - dx) / radial;
+				y = (yd - dy) / radial;
+			}
+
+			ray_x_[(size_t)v * intrinsics.width + u] = (float)x;
+			ray_y_[(size_t)v * intrinsics.width + u] = (float)y;
+		}
+	}
+	return true;
+}
+
+void DepthUnprojector::setLimits(const float lo[3], const float hi[3]){
+	memcpy(lo_, lo, sizeof(lo_));
+	memcpy(hi_, hi, sizeof(hi_));
+}
+
+bool DepthUnprojector::unproject(const uint16_t *depth, size_t depth_step, const uint8_t *rgb, size_t rgb_step,
+                                 uint32_t width, uint32_t height, float depth_scale, PointCloudT &out) const {
+	out.points.clear();
+	out.width = 0;
+	out.height = 1;
+	out.is_dense = true;
+	if (!intrinsics_.valid || width != intrinsics_.width || height != intrinsics_.height)
+		return false;
+
+	const PointKernels &kernels = pointKernels();
+	out.points.resize((size_t)width * height);
+
+	//rows are contiguous in the ray table, the images may be padded
+	size_t n = 0;
+	for (uint32_t v = 0; v < height; v++){
+		const uint16_t *depth_row = (const uint16_t *)((const uint8_t *)depth + v * depth_step);
+		const uint8_t *rgb_row = rgb ? rgb + v * rgb_step : NULL;
+		size_t offset = (size_t)v * width;
+		n += kernels.unproject(depth_row, &ray_x_[offset], &ray_y_[offset], width, depth_scale, rgb_row,
+		                       lo_, hi_, &out.points[n]);
+	}
+
+	out.points.resize(n);
+	out.width = n;
+	return true;
+}
+
+}
@@ -0,0 +1,425 @@
+/*
+	History of detection results, see detection_history.h
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+#include "bimur_robot_vision/detection_history.h"
+
+namespace bimur_robot_vision
+{
+
+/*
+	spill file layout: the magic, then one SpillRecord per detection in time
+	order; the objects file holds the magic, then the SpillObjects of every
+	detection back to back. Objects are written before the record pointing
+	to them, so a record is only complete once its objects are.
+*/
+static const char spill_magic[8] = {'B', 'I', 'M', 'U', 'R', 'D', 'H', '2'};
+static const char spill_objects_magic[8] = {'B', 'I', 'M', 'U', 'R', 'D', 'O', '2'};
+
+struct SpillRecord
+{
+	uint64_t stamp;
+	uint32_t is_plane_found;
+	uint32_t num_objects;
+	float plane[4];
+	//index of the first object in the objects file
+	uint64_t first_object;
+};
+
+struct SpillObject
+{
+	int32_t id;
+	uint32_t type;
+	uint32_t points;
+	uint32_t rgb;
+	float centroid[3];
+	float dimensions[3];
+};
+
+static_assert(sizeof(SpillRecord) == 40 && sizeof(SpillObject) == 40, "spill records must not be padded");
+
+static std::string spillObjectsPath(const std::string &path){
+	return path + ".objects";
+}
+
+/*
+	Function: openSpillFile()
+	Inputs  : const std::string&, const char*, size_t, uint64_t&
+	Outputs : FILE*
+	Purpose : opens a spill file for appending, writing the magic if it is
+	          new, and counts the whole records in it. NULL if it cannot be
+	          opened or holds something else.
+*/
+static FILE *openSpillFile(const std::string &path, const char *magic, size_t record_size, uint64_t &records){
+	//appending mode: reads may go anywhere, writes always go to the end
+	FILE *file = fopen(path.c_str(), "a+b");
+	if (!file)
+		return NULL;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+
+	//a file cut off within the magic is started again
+	char head[sizeof(spill_magic)];
+	fseek(file, 0, SEEK_SET);
+	size_t head_size = fread(head, 1, sizeof(head), file);
+	if (memcmp(head, magic, head_size) != 0){
+		fclose(file);
+		return NULL;
+	}
+	if (head_size < sizeof(head)){
+		fseek(file, 0, SEEK_SET);
+		if (ftruncate(fileno(file), 0) != 0 || fwrite(magic, sizeof(head), 1, file) != 1 || fflush(file) != 0){
+			fclose(file);
+			return NULL;
+		}
+		size = sizeof(head);
+	}
+	records = (uint64_t)(size - sizeof(head)) / record_size;
+	return file;
+}
+
+/*
+	Function: truncateSpillFile()
+	Inputs  : FILE*, size_t, uint64_t
+	Outputs : bool
+	Purpose : cuts a spill file down to its first records whole records
+*/
+static bool truncateSpillFile(FILE *file, size_t record_size, uint64_t records){
+	fflush(file);
+	bool ok = ftruncate(fileno(file), (off_t)(sizeof(spill_magic) + records * record_size)) == 0;
+	fseek(file, 0, SEEK_END);
+	return ok;
+}
+
+/*
+	Function: readSpillRecord()
+	Inputs  : FILE*, uint64_t, SpillRecord&
+	Outputs : bool
+	Purpose : reads record i of a spill file
+*/
+static bool readSpillRecord(FILE *file, uint64_t i, SpillRecord &record){
+	return fseek(file, (long)(sizeof(spill_magic) + i * sizeof(SpillRecord)), SEEK_SET) == 0 &&
+	       fread(&record, sizeof(record), 1, file) == 1;
+}
+
+void summarizeDetection(const TabletopResult &result, const ObjectPrimitives &primitives, uint64_t stamp,
+                        DetectionSummary &out){
+	out.stamp = stamp;
+	out.is_plane_found = result.is_plane_found;
+	for (int k = 0; k < 4; k++)
+		out.plane[k] = result.plane_coefficients(k);
+
+	out.objects.resize(primitives.size());
+	for (size_t i = 0; i < primitives.size(); i++){
+		const ObjectPrimitive &primitive = primitives[i];
+		const ClusterView &view = result.clusters[primitive.cluster];
+		const ClusterAggregate &aggregate = view.aggregate;
+		ObjectSummary &object = out.objects[i];
+		object.id = primitive.id;
+		object.type = primitive.type;
+		object.points = (uint32_t)aggregate.count;
+
+		Eigen::Vector3f centroid = aggregate.centroid();
+		for (int k = 0; k < 3; k++){
+			object.centroid[k] = centroid(k);
+			object.dimensions[k] = primitive.dimensions(k);
+		}
+
+		object.rgb = ((uint32_t)view.mean_rgb(0) << 16) | ((uint32_t)view.mean_rgb(1) << 8) |
+		             (uint32_t)view.mean_rgb(2);
+	}
+}
+
+
+DetectionHistory::DetectionHistory()
+	: head_(0),
+	  size_(0),
+	  objects_begin_(0),
+	  objects_end_(0),
+	  spill_records_(NULL),
+	  spill_objects_(NULL),
+	  spill_objects_end_(0),
+	  spill_stamp_(0),
+	  last_spilled_(true)
+{
+}
+
+DetectionHistory::~DetectionHistory(){
+	closeSpill();
+}
+
+void DetectionHistory::setCapacity(size_t detections, size_t objects){
+	stamps_.assign(detections, 0);
+	plane_found_.assign(detections, 0);
+	planes_.assign(4 * detections, 0.0f);
+	object_begins_.assign(detections, 0);
+	object_counts_.assign(detections, 0);
+
+	object_ids_.assign(objects, 0);
+	object_types_.assign(objects, 0);
+	object_points_.assign(objects, 0);
+	object_centroids_.assign(3 * objects, 0.0f);
+	object_dimensions_.assign(3 * objects, 0.0f);
+	object_rgb_.assign(objects, 0);
+	clear();
+}
+
+void DetectionHistory::clear(){
+	head_ = 0;
+	size_ = 0;
+	objects_begin_ = 0;
+	objects_end_ = 0;
+}
+
+void DetectionHistory::closeSpill(){
+	if (spill_records_)
+		fclose(spill_records_);
+	if (spill_objects_)
+		fclose(spill_objects_);
+	spill_records_ = NULL;
+	spill_objects_ = NULL;
+}
+
+bool DetectionHistory::spillTo(const std::string &path){
+	closeSpill();
+	spill_path_.clear();
+	last_spilled_ = true;
+	if (path.empty())
+		return true;
+
+	uint64_t records = 0, objects = 0;
+	spill_records_ = openSpillFile(path, spill_magic, sizeof(SpillRecord), records);
+	if (spill_records_)
+		spill_objects_ = openSpillFile(spillObjectsPath(path), spill_objects_magic, sizeof(SpillObject), objects);
+	if (!spill_objects_){
+		closeSpill();
+		return false;
+	}
+
+	//drop what a crash left behind: a torn record, records whose objects were not all
+	//written, and objects of a record that was not written
+	SpillRecord last;
+	while (records > 0 && readSpillRecord(spill_records_, records - 1, last) &&
+	       last.first_object + last.num_objects > objects)
+		records--;
+	spill_objects_end_ = records > 0 ? last.first_object + last.num_objects : 0;
+	spill_stamp_ = records > 0 ? last.stamp : 0;
+	if (!truncateSpillFile(spill_records_, sizeof(SpillRecord), records) ||
+	    !truncateSpillFile(spill_objects_, sizeof(SpillObject), spill_objects_end_)){
+		closeSpill();
+		return false;
+	}
+
+	spill_path_ = path;
+	return true;
+}
+
+bool DetectionHistory::spill(const DetectionSummary &summary){
+	SpillRecord record;
+	record.stamp = summary.stamp;
+	record.is_plane_found = summary.is_plane_found;
+	record.num_objects = (uint32_t)summary.objects.size();
+	memcpy(record.plane, summary.plane, sizeof(record.plane));
+	record.first_object = spill_objects_end_;
+
+	std::vector<SpillObject> objects(summary.objects.size());
+	for (size_t j = 0; j < objects.size(); j++){
+		const ObjectSummary &object = summary.objects[j];
+		objects[j].id = object.id;
+		objects[j].type = object.type;
+		objects[j].points = object.points;
+		objects[j].rgb = object.rgb;
+		memcpy(objects[j].centroid, object.centroid, sizeof(objects[j].centroid));
+		memcpy(objects[j].dimensions, object.dimensions, sizeof(objects[j].dimensions));
+	}
+
+	//objects first, so a record on disk always has its objects
+	bool ok = objects.empty() ||
+	          fwrite(&objects[0], sizeof(SpillObject), objects.size(), spill_objects_) == objects.size();
+	ok = ok && fflush(spill_objects_) == 0;
+	ok = ok && fwrite(&record, sizeof(record), 1, spill_records_) == 1;
+	ok = ok && fflush(spill_records_) == 0;
+	if (!ok){
+		//the files may end in a partial write now; they are cut back when opened again
+		closeSpill();
+		return false;
+	}
+	spill_objects_end_ += objects.size();
+	spill_stamp_ = summary.stamp;
+	return true;
+}
+
+void DetectionHistory::dropOldest(){
+	objects_begin_ += object_counts_[head_];
+	head_ = (head_ + 1) % stamps_.size();
+	size_--;
+	if (size_ == 0)
+		objects_begin_ = objects_end_;
+}
+
+bool DetectionHistory::add(const DetectionSummary &summary){
+	last_spilled_ = spill_path_.empty();
+	if (size_ > 0 && summary.stamp < stamp(size_ - 1))
+		return false;
+
+	//the spill file stays in time order across runs, for readSpilled()
+	if (spill_records_ && summary.stamp >= spill_stamp_)
+		last_spilled_ = spill(summary);
+
+	if (stamps_.empty())
+		return true;
+
+	//a detection with more objects than the object ring holds keeps the first ones
+	const size_t object_capacity = object_ids_.size();
+	const size_t count = std::min(summary.objects.size(), object_capacity);
+	while (size_ > 0 && (size_ == stamps_.size() || objects_end_ - objects_begin_ + count > object_capacity))
+		dropOldest();
+
+	size_t s = (head_ + size_) % stamps_.size();
+	stamps_[s] = summary.stamp;
+	plane_found_[s] = summary.is_plane_found;
+	std::copy(summary.plane, summary.plane + 4, &planes_[4 * s]);
+	object_begins_[s] = objects_end_;
+	object_counts_[s] = (uint32_t)count;
+	size_++;
+
+	for (size_t j = 0; j < count; j++){
+		const ObjectSummary &object = summary.objects[j];
+		size_t o = (size_t)(objects_end_ % object_capacity);
+		object_ids_[o] = object.id;
+		object_types_[o] = (uint8_t)object.type;
+		object_points_[o] = object.points;
+		std::copy(object.centroid, object.centroid + 3, &object_centroids_[3 * o]);
+		std::copy(object.dimensions, object.dimensions + 3, &object_dimensions_[3 * o]);
+		object_rgb_[o] = object.rgb;
+		objects_end_++;
+	}
+	return true;
+}
+
+void DetectionHistory::range(uint64_t begin, uint64_t end, size_t &first, size_t &last) const {
+	//first detection stamped at or after begin
+	size_t lo = 0, hi = size_;
+	while (lo < hi){
+		size_t mid = (lo + hi) / 2;
+		if (stamp(mid) < begin)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+
+	//first detection stamped after end
+	hi = size_;
+	while (lo < hi){
+		size_t mid = (lo + hi) / 2;
+		if (stamp(mid) <= end)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	last = std::max(lo, first);
+}
+
+ObjectSummary DetectionHistory::object(size_t i, size_t j) const {
+	size_t o = (size_t)((object_begins_[slot(i)] + j) % object_ids_.size());
+	ObjectSummary out;
+	out.id = object_ids_[o];
+	out.type = (PrimitiveType)object_types_[o];
+	out.points = object_points_[o];
+	std::copy(&object_centroids_[3 * o], &object_centroids_[3 * o] + 3, out.centroid);
+	std::copy(&object_dimensions_[3 * o], &object_dimensions_[3 * o] + 3, out.dimensions);
+	out.rgb = object_rgb_[o];
+	return out;
+}
+
+void DetectionHistory::get(size_t i, DetectionSummary &out) const {
+	out.stamp = stamp(i);
+	out.is_plane_found = isPlaneFound(i);
+	std::copy(plane(i), plane(i) + 4, out.plane);
+	out.objects.resize(numObjects(i));
+	for (size_t j = 0; j < out.objects.size(); j++)
+		out.objects[j] = object(i, j);
+}
+
+bool DetectionHistory::readSpilled(const std::string &path, uint64_t begin, uint64_t end, size_t max,
+                                   std::vector<DetectionSummary> &out){
+	out.clear();
+	FILE *records_file = fopen(path.c_str(), "rb");
+	FILE *objects_file = fopen(spillObjectsPath(path).c_str(), "rb");
+	char magic[sizeof(spill_magic)], objects_magic[sizeof(spill_objects_magic)];
+	if (!records_file || !objects_file ||
+	    fread(magic, sizeof(magic), 1, records_file) != 1 || memcmp(magic, spill_magic, sizeof(magic)) != 0 ||
+	    fread(objects_magic, sizeof(objects_magic), 1, objects_file) != 1 ||
+	    memcmp(objects_magic, spill_objects_magic, sizeof(objects_magic)) != 0){
+		if (records_file)
+			fclose(records_file);
+		if (objects_file)
+			fclose(objects_file);
+		return false;
+	}
+	fseek(records_file, 0, SEEK_END);
+	const uint64_t records = (uint64_t)(ftell(records_file) - sizeof(magic)) / sizeof(SpillRecord);
+
+	//first record stamped at or after begin
+	SpillRecord record;
+	bool ok = true;
+	uint64_t lo = 0, hi = records;
+	while (lo < hi){
+		uint64_t mid = (lo + hi) / 2;
+		if (!readSpillRecord(records_file, mid, record)){
+			ok = false;
+			break;
+		}
+		if (record.stamp < begin)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	//then read on until past end; the objects of consecutive records follow each other
+	std::vector<SpillObject> objects;
+	uint64_t next_object = (uint64_t)-1;
+	if (ok && lo < records)
+		ok = fseek(records_file, (long)(sizeof(magic) + lo * sizeof(SpillRecord)), SEEK_SET) == 0;
+	for (uint64_t i = lo; ok && i < records && (max == 0 || out.size() < max); i++){
+		if (fread(&record, sizeof(record), 1, records_file) != 1 || record.stamp > end)
+			break;
+
+		objects.resize(record.num_objects);
+		if (record.first_object != next_object &&
+		    fseek(objects_file, (long)(sizeof(spill_objects_magic) + record.first_object * sizeof(SpillObject)),
+		          SEEK_SET) != 0)
+			break;
+		if (!objects.empty() &&
+		    fread(&objects[0], sizeof(SpillObject), objects.size(), objects_file) != objects.size())
+			break;
+		next_object = record.first_object + record.num_objects;
+
+		out.push_back(DetectionSummary());
+		DetectionSummary &summary = out.back();
+		summary.stamp = record.stamp;
+		summary.is_plane_found = record.is_plane_found != 0;
+		memcpy(summary.plane, record.plane, sizeof(summary.plane));
+		summary.objects.resize(objects.size());
+		for (size_t j = 0; j < objects.size(); j++){
+			ObjectSummary &object = summary.objects[j];
+			object.id = objects[j].id;
+			object.type = (PrimitiveType)objects[j].type;
+			object.points = objects[j].points;
+			object.rgb = objects[j].rgb;
+			memcpy(object.centroid, objects[j].centroid, sizeof(object.centroid));
+			memcpy(object.dimensions, objects[j].dimensions, sizeof(object.dimensions));
+		}
+	}
+
+	fclose(records_file);
+	fclose(objects_file);
+	return ok;
+}
+
+}
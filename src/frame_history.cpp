@@ -0,0 +1,258 @@
+/*
+	Compact ring buffer of input frames, see frame_history.h
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+#include "bimur_robot_vision/frame_history.h"
+#include "bimur_robot_vision/point_kernels.h"
+
+namespace bimur_robot_vision
+{
+
+//maximum reprojection error (pixels) for a frame to be stored as a depth image
+static const float max_pixel_error = 0.5f;
+
+static bool isValid(const pcl::PointXYZRGB &p){
+	return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z) && p.z > 0.0f;
+}
+
+size_t EncodedFrame::memoryUsage() const {
+	return depth.capacity() * sizeof(uint16_t) + xyz.capacity() * sizeof(int16_t) + rgb.capacity();
+}
+
+
+FrameHistory::FrameHistory(size_t capacity)
+	: ring_(capacity),
+	  head_(0),
+	  size_(0)
+{
+}
+
+void FrameHistory::setCapacity(size_t capacity){
+	ring_.clear();
+	ring_.resize(capacity);
+	head_ = 0;
+	size_ = 0;
+}
+
+void FrameHistory::clear(){
+	head_ = 0;
+	size_ = 0;
+}
+
+const EncodedFrame &FrameHistory::frame(size_t i) const {
+	//head_ is the slot the next frame goes to
+	return ring_[(head_ + ring_.size() - 1 - i) % ring_.size()];
+}
+
+size_t FrameHistory::memoryUsage() const {
+	size_t total = 0;
+	for (size_t i = 0; i < ring_.size(); i++)
+		total += ring_[i].memoryUsage();
+	return total;
+}
+
+/*
+	Function: estimateIntrinsics()
+	Inputs  : const PointCloudT&, CameraIntrinsics&
+	Outputs : bool
+	Purpose : least squares fit of u = fx * x/z + cx and v = fy * y/z + cy
+	          over a sparse grid of valid pixels
+*/
+bool FrameHistory::estimateIntrinsics(const PointCloudT &frame, CameraIntrinsics &out) const {
+	double su = 0, sa = 0, saa = 0, sau = 0;
+	double sv = 0, sb = 0, sbb = 0, sbv = 0;
+	int n = 0;
+
+	for (uint32_t v = 0; v < frame.height; v += 4){
+		for (uint32_t u = 0; u < frame.width; u += 4){
+			const PointT &p = frame.points[v * frame.width + u];
+			if (!isValid(p))
+				continue;
+			double a = p.x / p.z;
+			double b = p.y / p.z;
+			su += u; sa += a; saa += a * a; sau += a * u;
+			sv += v; sb += b; sbb += b * b; sbv += b * v;
+			n++;
+		}
+	}
+
+	if (n < 100)
+		return false;
+
+	double da = n * saa - sa * sa;
+	double db = n * sbb - sb * sb;
+	if (std::fabs(da) < 1e-12 || std::fabs(db) < 1e-12)
+		return false;
+
+	out.fx = (float)((n * sau - sa * su) / da);
+	out.cx = (float)((su - out.fx * sa) / n);
+	out.fy = (float)((n * sbv - sb * sv) / db);
+	out.cy = (float)((sv - out.fy * sb) / n);
+	out.width = frame.width;
+	out.height = frame.height;
+	out.valid = true;
+
+	return checkIntrinsics(frame, out);
+}
+
+void FrameHistory::setIntrinsics(const CameraIntrinsics &intrinsics){
+	intrinsics_ = intrinsics;
+
+	col_ray_.resize(intrinsics.width);
+	for (uint32_t u = 0; u < intrinsics.width; u++)
+		col_ray_[u] = ((float)u - intrinsics.cx) / intrinsics.fx;
+	row_ray_.resize(intrinsics.height);
+	for (uint32_t v = 0; v < intrinsics.height; v++)
+		row_ray_[v] = ((float)v - intrinsics.cy) / intrinsics.fy;
+}
+
+/*
+	Function: checkIntrinsics()
+	Inputs  : const PointCloudT&, const CameraIntrinsics&
+	Outputs : bool
+	Purpose : verifies on a few pixels that the intrinsics reproject the frame
+*/
+bool FrameHistory::checkIntrinsics(const PointCloudT &frame, const CameraIntrinsics &intrinsics) const {
+	if (!intrinsics.valid || frame.width != intrinsics.width || frame.height != intrinsics.height)
+		return false;
+
+	int checked = 0;
+	for (uint32_t v = frame.height / 16; v < frame.height; v += frame.height / 8 + 1){
+		for (uint32_t u = frame.width / 16; u < frame.width; u += frame.width / 8 + 1){
+			const PointT &p = frame.points[v * frame.width + u];
+			if (!isValid(p))
+				continue;
+			float pu = intrinsics.fx * p.x / p.z + intrinsics.cx;
+			float pv = intrinsics.fy * p.y / p.z + intrinsics.cy;
+			if (std::fabs(pu - u) > max_pixel_error || std::fabs(pv - v) > max_pixel_error)
+				return false;
+			checked++;
+		}
+	}
+	return checked > 0;
+}
+
+void FrameHistory::encodePinhole(const PointCloudT &frame, EncodedFrame &out) const {
+	size_t n = frame.points.size();
+	out.pinhole = true;
+	out.depth.resize(n);
+	out.rgb.resize(3 * n);
+	out.xyz.clear();
+
+	for (size_t i = 0; i < n; i++){
+		const PointT &p = frame.points[i];
+		float mm = p.z * 1000.0f + 0.5f;
+		out.depth[i] = (isValid(p) && mm < 65535.0f) ? (uint16_t)mm : 0;
+	}
+	if (n > 0)
+		pointKernels().unpack_rgb(&frame.points[0], n, &out.rgb[0]);
+}
+
+void FrameHistory::encodePoints(const PointCloudT &frame, EncodedFrame &out) const {
+	size_t n = frame.points.size();
+	out.pinhole = false;
+	out.xyz.resize(3 * n);
+	out.rgb.resize(3 * n);
+	out.depth.clear();
+
+	for (size_t i = 0; i < n; i++){
+		const PointT &p = frame.points[i];
+		if (!isValid(p) || std::fabs(p.x) > 32.0f || std::fabs(p.y) > 32.0f || p.z > 32.0f){
+			out.xyz[3 * i] = std::numeric_limits<int16_t>::min();
+			out.xyz[3 * i + 1] = 0;
+			out.xyz[3 * i + 2] = 0;
+		} else {
+			out.xyz[3 * i] = (int16_t)std::floor(p.x * 1000.0f + 0.5f);
+			out.xyz[3 * i + 1] = (int16_t)std::floor(p.y * 1000.0f + 0.5f);
+			out.xyz[3 * i + 2] = (int16_t)std::floor(p.z * 1000.0f + 0.5f);
+		}
+	}
+	if (n > 0)
+		pointKernels().unpack_rgb(&frame.points[0], n, &out.rgb[0]);
+}
+
+void FrameHistory::push(const PointCloudT &frame){
+	if (ring_.empty())
+		return;
+
+	//organized frames share one set of intrinsics; when they stop fitting the
+	//camera changed and the frames encoded with the old ones are dropped
+	bool pinhole = false;
+	if (frame.height > 1){
+		pinhole = checkIntrinsics(frame, intrinsics_);
+		CameraIntrinsics estimated;
+		if (!pinhole && estimateIntrinsics(frame, estimated)){
+			clear();
+			setIntrinsics(estimated);
+			pinhole = true;
+		}
+	}
+
+	EncodedFrame &out = ring_[head_];
+	out.seq = frame.header.seq;
+	out.stamp = frame.header.stamp;
+	out.frame_id = frame.header.frame_id;
+	out.width = frame.width;
+	out.height = frame.height;
+
+	if (pinhole)
+		encodePinhole(frame, out);
+	else
+		encodePoints(frame, out);
+
+	head_ = (head_ + 1) % ring_.size();
+	if (size_ < ring_.size())
+		size_++;
+}
+
+void FrameHistory::decode(size_t i, PointCloudT &out) const {
+	const EncodedFrame &in = frame(i);
+	size_t n = in.size();
+
+	out.points.resize(n);
+	out.header.seq = in.seq;
+	out.header.stamp = in.stamp;
+	out.header.frame_id = in.frame_id;
+
+	size_t count = 0;
+	if (in.pinhole){
+		//one unproject kernel call per row, over the column rays and the ray of the row
+		const PointKernels &kernels = pointKernels();
+		const float lo[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+		const float hi[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+		std::vector<float> row_ray(in.width);
+		for (uint32_t v = 0; v < in.height && in.width > 0; v++){
+			std::fill(row_ray.begin(), row_ray.end(), row_ray_[v]);
+			size_t offset = (size_t)v * in.width;
+			count += kernels.unproject(&in.depth[offset], &col_ray_[0], &row_ray[0], in.width, 0.001f,
+			                           &in.rgb[3 * offset], lo, hi, &out.points[0] + count);
+		}
+	} else {
+		for (size_t j = 0; j < n; j++){
+			if (in.xyz[3 * j] == std::numeric_limits<int16_t>::min())
+				continue;
+			PointT &p = out.points[count++];
+			p.x = in.xyz[3 * j] * 0.001f;
+			p.y = in.xyz[3 * j + 1] * 0.001f;
+			p.z = in.xyz[3 * j + 2] * 0.001f;
+			p.data[3] = 1.0f;
+			p.r = in.rgb[3 * j];
+			p.g = in.rgb[3 * j + 1];
+			p.b = in.rgb[3 * j + 2];
+			p.a = 255;
+		}
+	}
+
+	//points without depth are left out, the frame is no longer organized
+	out.points.resize(count);
+	out.width = count;
+	out.height = 1;
+	out.is_dense = true;
+}
+
+}
@@ -5,50 +5,49 @@
 */
 
 #include <signal.h>
+#include <cstddef>
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include <string>
 #include <sys/stat.h>
 #include <ros/ros.h>
 #include <ros/package.h>
 #include <std_srvs/Empty.h>
+#include <std_msgs/Header.h>
 
 #include <sensor_msgs/PointCloud2.h>
-
-#include <visualization_msgs/Marker.h>
-#include <visualization_msgs/MarkerArray.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
+#include <sensor_msgs/image_encodings.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <moveit_msgs/CollisionObject.h>
+#include <shape_msgs/SolidPrimitive.h>
 
 #include <tf/transform_listener.h>
 #include <tf/tf.h>
 
-#include <pcl_ros/impl/transforms.hpp>
+#include <Eigen/Geometry>
 
-// PCL specific includes
-#include <pcl/io/io.h>
-#include <pcl/io/pcd_io.h>
+// PCL specific includes (conversions only, the pipeline is in the library)
 #include <pcl/conversions.h>
 #include <pcl_conversions/pcl_conversions.h>
 #include <pcl/point_cloud.h>
-#include <pcl/console/parse.h>
 #include <pcl/point_types.h>
-#include <pcl/io/openni_grabber.h>
-#include <pcl/sample_consensus/sac_model_plane.h>
-#include <pcl/common/time.h>
-#include <pcl/common/common.h>
-
-#include <pcl/filters/crop_box.h>
-#include <pcl/filters/passthrough.h>
-#include <pcl/filters/voxel_grid.h>
-#include <pcl/filters/extract_indices.h>
-#include <pcl/visualization/pcl_visualizer.h>
-
-#include <pcl/ModelCoefficients.h>
-#include <pcl/sample_consensus/method_types.h>
-#include <pcl/sample_consensus/model_types.h>
-#include <pcl/segmentation/sac_segmentation.h>
-#include <pcl/segmentation/extract_clusters.h>
-
-#include <pcl/kdtree/kdtree.h>
+
 #include "bimur_robot_vision/TabletopPerception.h"
+#include "bimur_robot_vision/TablePlacement.h"
+#include "bimur_robot_vision/TablePresence.h"
+#include "bimur_robot_vision/DetectionHistoryQuery.h"
+#include "bimur_robot_vision/tabletop_detector.h"
+#include "bimur_robot_vision/frame_history.h"
+#include "bimur_robot_vision/point_kernels.h"
+#include "bimur_robot_vision/collision_primitives.h"
+#include "bimur_robot_vision/table_presence.h"
+#include "bimur_robot_vision/depth_unprojector.h"
+#include "bimur_robot_vision/detection_history.h"
 
 
 /* define what kind of point clouds we're using */
@@ -68,21 +67,107 @@ static int red_min;
 // Select mode
 const bool save_pl_mode = false;
 
+//keep the clustering state across frames and only process changed voxels
+bool incremental_clustering_mode = true;
+
+//the detection pipeline and its reused output buffers
+bimur_robot_vision::TabletopDetector detector;
+bimur_robot_vision::TabletopResult detection;
+//header of the cloud the last detection ran on
+pcl::PCLHeader detection_header;
+
+//cell size of the table occupancy grid, 0 disables it and the placement service
+double table_grid_resolution = 0.01;
+
+//publish a box or cylinder per detected object for the planning scene, in
+//collision_frame (the camera frame if empty)
+bool collision_objects_mode = true;
+std::string collision_frame;
+ros::Publisher collision_pub;
+
+//objects that moved less than this between detections keep their collision object id
+bimur_robot_vision::PrimitiveTracker primitive_tracker(0.05f);
+
+//summaries of past detections, no points; appended to detection_history_file if set
+int detection_history_size = 1000;
+std::string detection_history_file;
+bimur_robot_vision::DetectionHistory detection_history;
+
+//presence and count checks against the table of the last detection
+bimur_robot_vision::TablePresence table_presence;
+bimur_robot_vision::PresenceResult presence;
+
+//recent input frames, stored as 16-bit depth + 24-bit colour
+int history_size = 30;
+bimur_robot_vision::FrameHistory frame_history(history_size);
+
+//live aggregation of consecutive frames gives up after this many gaps
+int max_restarts = 10;
+
 // Mutex: //
 boost::mutex cloud_mutex;
 
 bool new_cloud_available_flag = false;
+
+//ingest sequence number of the latest cloud, counts every received frame and
+//every frame the transport lost on the way
+uint32_t cloud_ingest_seq = 0;
+//stamp and publisher sequence number of the latest cloud, and running estimate
+//of the sensor's frame period
+ros::Time last_cloud_stamp;
+uint32_t last_header_seq = 0;
+double frame_period = 0.0;
+
+//frames up to this much older than the latest one are late and dropped, a
+//bigger step back starts over (bag loop, driver restart, sim time reset)
+double late_tolerance = 1.0;
+
+//incoming frames queued by roscpp, so a burst reaches ingestFrame() to be skipped there
+int queue_size = 10;
+
+//latest received message; it is only decoded into cloud when it is used, so
+//frames superseded during a burst are never decoded
+sensor_msgs::PointCloud2ConstPtr latest_msg;
+
+//depth image input instead of the driver's cloud: the latest depth image,
+//the latest colour image registered to it, and the ray table of the camera
+bool depth_input_mode = false;
+sensor_msgs::ImageConstPtr latest_depth;
+sensor_msgs::ImageConstPtr latest_rgb;
+bimur_robot_vision::DepthUnprojector unprojector;
+std::vector<uint8_t> rgb_scratch;
+std::vector<uint16_t> depth_scratch;
+uint32_t latest_msg_seq = 0;
+uint32_t decoded_seq = 0;
+
+//share of every frame period that decoding ahead may take; frames are only
+//decoded for the history while there is budget left, requests decode what they
+//use without being charged for it
+double decode_budget = 0.5;
+double decode_credit = 0.0;
+ros::WallTime last_credit_update;
+
+//ingestion counters
+struct IngestStats
+{
+	unsigned long received;
+	unsigned long decoded;
+	unsigned long superseded;
+	unsigned long late;
+	unsigned long over_budget;
+	unsigned long lost;
+	unsigned long resets;
+} ingest = {0, 0, 0, 0, 0, 0, 0};
 PointCloudT::Ptr cloud (new PointCloudT);
 PointCloudT::Ptr cloud_aggregated (new PointCloudT);
-PointCloudT::Ptr cloud_plane (new PointCloudT);
-PointCloudT::Ptr cloud_blobs (new PointCloudT);
-PointCloudT::Ptr empty_cloud (new PointCloudT);
-std::vector<PointCloudT::Ptr > clusters_on_plane;
 
 sensor_msgs::PointCloud2 cloud_ros;
 
 ros::Publisher cloud_pub;
 
+//transforms for requests that ask for a target_frame
+tf::TransformListener *tf_listener = NULL;
+
 //true if Ctrl-C is pressed
 bool g_caught_sigint=false;
 
@@ -112,70 +197,276 @@ void sig_handler(int sig)
   exit(1);
 };
 
+/*
+	Function: unprojectDepth()
+	Inputs  : const sensor_msgs::Image&, const sensor_msgs::ImageConstPtr&, PointCloudT&
+	Outputs : bool
+	Purpose : turns a 16-bit depth image, and the colour image if it matches,
+	          into the points within the detector's limits
+*/
+bool unprojectDepth(const sensor_msgs::Image &depth, const sensor_msgs::ImageConstPtr &rgb, PointCloudT &out){
+	pcl_conversions::toPCL(depth.header, out.header);
+	if (depth.encoding != sensor_msgs::image_encodings::TYPE_16UC1 &&
+	    depth.encoding != sensor_msgs::image_encodings::MONO16){
+		ROS_WARN_THROTTLE(10, "Depth images encoded as %s are not supported, expected 16UC1", depth.encoding.c_str());
+		out.clear();
+		return false;
+	}
+	if (depth.width == 0 || depth.height == 0 || depth.step < depth.width * sizeof(uint16_t) ||
+	    depth.data.size() < (size_t)depth.step * depth.height){
+		ROS_WARN_THROTTLE(10, "Empty or truncated %ux%u depth image", depth.width, depth.height);
+		out.clear();
+		return false;
+	}
+
+	//big-endian images are swapped into a scratch copy
+	const uint16_t *depth_data = (const uint16_t *)&depth.data[0];
+	size_t depth_step = depth.step;
+	if (depth.is_bigendian){
+		depth_scratch.resize((size_t)depth.width * depth.height);
+		for (uint32_t v = 0; v < depth.height; v++){
+			const uint8_t *in = &depth.data[(size_t)v * depth.step];
+			uint16_t *row = &depth_scratch[(size_t)v * depth.width];
+			for (uint32_t u = 0; u < depth.width; u++)
+				row[u] = (uint16_t)((in[2 * u] << 8) | in[2 * u + 1]);
+		}
+		depth_data = &depth_scratch[0];
+		depth_step = depth.width * sizeof(uint16_t);
+	}
+
+	const uint8_t *colour = NULL;
+	size_t colour_step = 0;
+	if (rgb && rgb->width == depth.width && rgb->height == depth.height &&
+	    rgb->step >= rgb->width * 3 && rgb->data.size() >= (size_t)rgb->step * rgb->height){
+		if (rgb->encoding == sensor_msgs::image_encodings::RGB8){
+			colour = &rgb->data[0];
+			colour_step = rgb->step;
+		} else if (rgb->encoding == sensor_msgs::image_encodings::BGR8){
+			rgb_scratch.resize((size_t)rgb->width * rgb->height * 3);
+			for (uint32_t v = 0; v < rgb->height; v++){
+				const uint8_t *in = &rgb->data[(size_t)v * rgb->step];
+				uint8_t *row = &rgb_scratch[(size_t)v * rgb->width * 3];
+				for (uint32_t u = 0; u < rgb->width; u++){
+					row[3 * u] = in[3 * u + 2];
+					row[3 * u + 1] = in[3 * u + 1];
+					row[3 * u + 2] = in[3 * u];
+				}
+			}
+			colour = &rgb_scratch[0];
+			colour_step = (size_t)rgb->width * 3;
+		}
+	}
+
+	bool ok = unprojector.unproject(depth_data, depth_step, colour, colour_step,
+	                                depth.width, depth.height, 0.001f, out);
+	if (!ok)
+		ROS_WARN_THROTTLE(10, "No camera info matching the %ux%u depth images yet", depth.width, depth.height);
+	pcl_conversions::toPCL(depth.header, out.header);
+	return ok;
+}
+
+/*
+	Function: decodeLatest()
+	Inputs  : None
+	Outputs : None
+	Purpose : decodes the latest message into cloud, unless it already is, and
+	          keeps a compact copy of it in the history
+*/
+void decodeLatest(){
+	cloud_mutex.lock ();
+	sensor_msgs::PointCloud2ConstPtr msg = latest_msg;
+	sensor_msgs::ImageConstPtr depth = latest_depth;
+	sensor_msgs::ImageConstPtr rgb = latest_rgb;
+	uint32_t seq = latest_msg_seq;
+	cloud_mutex.unlock ();
+
+	if ((!msg && !depth) || seq == decoded_seq)
+		return;
+
+	//convert to PCL format
+	bool decoded = true;
+	if (depth)
+		decoded = unprojectDepth(*depth, rgb, *cloud);
+	else
+		pcl::fromROSMsg (*msg, *cloud);
+
+	//number frames on arrival, so that frames overwritten before use show up as gaps
+	cloud->header.seq = seq;
+	decoded_seq = seq;
+	if (!decoded)
+		return;
+
+	//keep a compact copy for later aggregation or replay
+	frame_history.push(*cloud);
+
+	ingest.decoded++;
+}
+
+/*
+	Function: decodeBudgetLeft()
+	Inputs  : None
+	Outputs : bool
+	Purpose : refills the decode budget for the time that passed; true if
+	          some is left. Unused budget is not saved up beyond one frame.
+*/
+bool decodeBudgetLeft(){
+	ros::WallTime now = ros::WallTime::now();
+	double period = frame_period > 0.0 ? frame_period : 1.0 / 30.0;
+	if (!last_credit_update.isZero())
+		decode_credit = std::min(decode_credit + (now - last_credit_update).toSec() * decode_budget,
+		                         decode_budget * period);
+	last_credit_update = now;
+	return decode_credit > 0.0;
+}
+
+/*
+	Function: ingestFrame()
+	Inputs  : const std_msgs::Header&
+	Outputs : bool
+	Purpose : bookkeeping of a new frame from its header alone; false if it
+	          arrived late and is dropped. Called with cloud_mutex held.
+*/
+bool ingestFrame(const std_msgs::Header &header){
+	const ros::Time &stamp = header.stamp;
+	ingest.received++;
+
+	if (!last_cloud_stamp.isZero() && stamp < last_cloud_stamp){
+		//frames a little older than the latest one are late deliveries, nothing to gain from them
+		if ((last_cloud_stamp - stamp).toSec() <= late_tolerance){
+			ingest.late++;
+			return false;
+		}
+		//the stored frames are from the time before the jump
+		ROS_WARN("Frame stamps went back by %.3f s, starting over", (last_cloud_stamp - stamp).toSec());
+		ingest.resets++;
+		last_cloud_stamp = ros::Time();
+		frame_history.clear();
+	}
+
+	//frames the publisher numbered but the transport never delivered; they widen
+	//the ingest sequence so that aggregation sees them as gaps
+	uint32_t lost = 0;
+	if (!last_cloud_stamp.isZero() && header.seq > last_header_seq)
+		lost = header.seq - last_header_seq - 1;
+	last_header_seq = header.seq;
+	ingest.lost += lost;
+
+	//moving average of the frame period, ignoring repeats and resets
+	double dt = (stamp - last_cloud_stamp).toSec();
+	if (!last_cloud_stamp.isZero() && dt > 0.0 && dt < 1.0)
+		frame_period = frame_period > 0.0 ? 0.9 * frame_period + 0.1 * dt : dt;
+	last_cloud_stamp = stamp;
+
+	//the previous frame is superseded if nothing decoded it
+	if (latest_msg_seq != 0 && latest_msg_seq != decoded_seq)
+		ingest.superseded++;
+	cloud_ingest_seq += 1 + lost;
+	latest_msg_seq = cloud_ingest_seq;
+
+	//state that a new cloud is available
+	new_cloud_available_flag = true;
+	return true;
+}
+
+/*
+	Function: decodeAhead()
+	Inputs  : None
+	Outputs : None
+	Purpose : decodes the latest frame for the history while within budget
+*/
+void decodeAhead(){
+	if (frame_history.capacity() == 0)
+		return;
+	if (!decodeBudgetLeft()){
+		ingest.over_budget++;
+		return;
+	}
+	//only decodes nobody asked for are charged, so a long aggregation does
+	//not starve the history afterwards
+	ros::WallTime start = ros::WallTime::now();
+	decodeLatest();
+	decode_credit -= (ros::WallTime::now() - start).toSec();
+}
+
 /*
 	Function: cloud_cb()
 	Inputs  : const sensor_msgs::PointCloud2ConstPtr& 
 	Outputs : None
-	Purpose : TODO
+	Purpose : takes in a new frame; only its header is looked at here, the
+	          points are decoded when they are used or there is budget left
 */
 void cloud_cb (const sensor_msgs::PointCloud2ConstPtr& input)
 {
 
 	cloud_mutex.lock ();
+	bool accepted = ingestFrame(input->header);
+	if (accepted)
+		latest_msg = input;
+	cloud_mutex.unlock ();
 
-	//convert to PCL format
-	pcl::fromROSMsg (*input, *cloud);
-
-	//state that a new cloud is available
-	new_cloud_available_flag = true;
+	if (accepted)
+		decodeAhead();
+}
 
+/*
+	Function: depth_cb()
+	Inputs  : const sensor_msgs::ImageConstPtr&
+	Outputs : None
+	Purpose : takes in a new depth image, like cloud_cb
+*/
+void depth_cb (const sensor_msgs::ImageConstPtr& input)
+{
+	cloud_mutex.lock ();
+	bool accepted = ingestFrame(input->header);
+	if (accepted)
+		latest_depth = input;
 	cloud_mutex.unlock ();
+
+	if (accepted)
+		decodeAhead();
 }
 
 /*
-	Function: filter()
-	Inputs  : PointCloudT::Ptr,  Eigen::Vector4f , double
-	Outputs : boolean
-	Purpose : Filters out the cloud points for the plane and objects near it
+	Function: rgb_cb()
+	Inputs  : const sensor_msgs::ImageConstPtr&
+	Outputs : None
+	Purpose : keeps the latest colour image for the next depth image
 */
-bool filter(PointCloudT::Ptr blob, Eigen::Vector4f plane_coefficients, double tolerance){
-	
-	double min_distance = 1000.0;
-	double max_distance = -1000.0;
-	
-	//first, we find the point in the blob closest to the plane
-	for (unsigned int i = 0; i < blob->points.size(); i++){
-		pcl::PointXYZ p_i;
-		p_i.x=blob->points.at(i).x;
-		p_i.y=blob->points.at(i).y;
-		p_i.z=blob->points.at(i).z;
-
-		double distance = pcl::pointToPlaneDistance(p_i, plane_coefficients);
-		
-		if (distance < min_distance){
-			min_distance = distance;
-		}
-		
-		if (distance > max_distance)
-			max_distance = distance;
-		
-		
-		
-	}
-	
-	
-	if (min_distance > tolerance)
-		return false;
-	/*else if (max_distance < 0.8*tolerance)
-		return false;	*/
-	
-	
-	ROS_INFO("\nMin Distance to plane for cluster with %i points: %f",(int)blob->points.size(),min_distance);
-	ROS_INFO("Max Distance to plane for cluster with %i points: %f",(int)blob->points.size(),max_distance);
+void rgb_cb (const sensor_msgs::ImageConstPtr& input)
+{
+	cloud_mutex.lock ();
+	latest_rgb = input;
+	cloud_mutex.unlock ();
+}
 
-	
-	return true;
-	
+/*
+	Function: camera_info_cb()
+	Inputs  : const sensor_msgs::CameraInfoConstPtr&
+	Outputs : None
+	Purpose : rebuilds the ray table of the depth camera when its model changes
+*/
+void camera_info_cb (const sensor_msgs::CameraInfoConstPtr& info)
+{
+	bimur_robot_vision::CameraIntrinsics intrinsics;
+	intrinsics.fx = info->K[0];
+	intrinsics.cx = info->K[2];
+	intrinsics.fy = info->K[4];
+	intrinsics.cy = info->K[5];
+	intrinsics.width = info->width;
+	intrinsics.height = info->height;
+	intrinsics.valid = intrinsics.fx > 0.0f && intrinsics.fy > 0.0f;
+	if (!intrinsics.valid)
+		return;
+
+	std::vector<double> distortion;
+	if (info->distortion_model == "plumb_bob")
+		distortion = info->D;
+	else if (!info->distortion_model.empty())
+		ROS_WARN_ONCE("Distortion model %s is not supported, depth images are not undistorted",
+		              info->distortion_model.c_str());
+
+	if (unprojector.setCamera(intrinsics, distortion))
+		ROS_INFO("Built the depth ray table for %ux%u", info->width, info->height);
 }
 
 /*
@@ -196,42 +487,6 @@ double computeAvgRedValue(PointCloudT::Ptr in){
 	return total_red;
 }
 
-/*
-	Function: computeClusters()
-	Inputs  : PointCloudT::Ptr , double
-	Outputs : std::vector<PointCloudT::Ptr >
-	Purpose : 
-*/
-std::vector<PointCloudT::Ptr > computeClusters(PointCloudT::Ptr in, double tolerance){
-	std::vector<PointCloudT::Ptr > clusters;
-	
-	pcl::search::KdTree<PointT>::Ptr tree (new pcl::search::KdTree<PointT>);
-	tree->setInputCloud (in);
-
-	std::vector<pcl::PointIndices> cluster_indices;
-	pcl::EuclideanClusterExtraction<PointT> ec;
-	ec.setClusterTolerance (tolerance); // 2cm
-	ec.setMinClusterSize (50);
-	ec.setMaxClusterSize (25000);
-	ec.setSearchMethod (tree);
-	ec.setInputCloud (in);
-	ec.extract (cluster_indices);
-
-	int j = 0;
-	for (std::vector<pcl::PointIndices>::const_iterator it = cluster_indices.begin (); it != cluster_indices.end (); ++it)
-	{
-		PointCloudT::Ptr cloud_cluster (new PointCloudT);
-		for (std::vector<int>::const_iterator pit = it->indices.begin (); pit != it->indices.end (); pit++)
-			cloud_cluster->points.push_back (in->points[*pit]); //*
-		cloud_cluster->width = cloud_cluster->points.size ();
-		cloud_cluster->height = 1;
-		cloud_cluster->is_dense = true;
-
-		clusters.push_back(cloud_cluster);
-	}
-	return clusters;
-}
-
 /*
 	Function: waitForCloud()
 	Inputs  : None
@@ -248,6 +503,7 @@ void waitForCloud(){
 		
 		if (new_cloud_available_flag){
 			new_cloud_available_flag = false;
+			decodeLatest();
 			break;
 		}
 	}
@@ -255,17 +511,60 @@ void waitForCloud(){
 }
 
 /*
-	Function: waitForCloud()
-	Inputs  : int
+	Which frames a request wants aggregated, and what happened while
+	collecting them
+*/
+struct FrameSelection
+{
+	int num_frames;
+	ros::Time newer_than;
+	bool consecutive;
+};
+
+struct FrameStats
+{
+	int used;
+	int dropped;
+	int duplicated;
+	int stale;
+	int restarts;
+	ros::Time first_stamp;
+	ros::Time last_stamp;
+};
+
+/*
+	Function: framesMissing()
+	Inputs  : ros::Time, ros::Time
+	Outputs : int
+	Purpose : number of frames the driver should have delivered between two
+	          stamps, judged by the measured frame period
+*/
+int framesMissing(const ros::Time &previous, const ros::Time &current){
+	double dt = (current - previous).toSec();
+	if (frame_period <= 0.0 || dt < 1.5 * frame_period)
+		return 0;
+	return (int)(dt / frame_period + 0.5) - 1;
+}
+
+/*
+	Function: waitForCloudK()
+	Inputs  : const FrameSelection&, PointCloudT&, FrameStats&
 	Outputs : None
-	Purpose : collects a cloud by aggregating k successive frames
+	Purpose : collects a cloud by aggregating k successive live frames, counting
+	          frames that were skipped, repeated or older than requested; in
+	          consecutive mode, returns the frames aggregated so far once
+	          max_restarts gaps have been met
 */
-void waitForCloudK(int k){
+void waitForCloudK(const FrameSelection &selection, PointCloudT &out, FrameStats &stats){
 	ros::Rate r(30);
 	
-	cloud_aggregated->clear();
+	out.clear();
 	
 	int counter = 0;
+	int restarts = 0;
+	uint32_t last_seq = 0;
+	ros::Time last_stamp;
+	pcl::PCLHeader last_header;
 	
 	while (ros::ok()){
 		ros::spinOnce();
@@ -274,19 +573,417 @@ void waitForCloudK(int k){
 		
 		if (new_cloud_available_flag){
 			
-			*cloud_aggregated+=*cloud;
-			
 			new_cloud_available_flag = false;
+			decodeLatest();
+
+			uint32_t seq = cloud->header.seq;
+			ros::Time stamp = pcl_conversions::fromPCL(cloud->header.stamp);
+
+			if (!selection.newer_than.isZero() && stamp <= selection.newer_than){
+				stats.stale++;
+				continue;
+			}
+
+			int missing = 0;
+			if (counter > 0){
+				if (stamp == last_stamp){
+					stats.duplicated++;
+					continue;
+				}
+				//frames that arrived while we were not looking, or never arrived at all; a
+				//frame skipped in the sequence also widens the stamp gap, so count it once
+				missing = std::max((int)(seq - last_seq - 1), framesMissing(last_stamp, stamp));
+				stats.dropped += missing;
+			}
+
+			if (selection.consecutive && missing > 0){
+				//a jittery sensor would keep the request waiting forever
+				if (restarts >= max_restarts){
+					ROS_WARN("Frame gap of %i frame(s) after %i restarts, returning %i of %i frames", missing,
+					         restarts, counter, selection.num_frames);
+					out.header = last_header;
+					stats.last_stamp = last_stamp;
+					break;
+				}
+				ROS_WARN("Frame gap of %i frame(s) while aggregating, restarting", missing);
+				out.clear();
+				counter = 0;
+				restarts++;
+				stats.restarts++;
+			}
+
+			if (counter == 0)
+				stats.first_stamp = stamp;
+			
+			out += *cloud;
+			last_seq = seq;
+			last_stamp = stamp;
+			last_header = cloud->header;
 			
 			counter ++;
 			
-			if (counter >= k){
-				cloud_aggregated->header = cloud->header;
+			if (counter >= selection.num_frames){
+				out.header = cloud->header;
+				stats.last_stamp = stamp;
 				break;
 			}
 		}
 	}
 	
+	stats.used = counter;
+}
+
+/*
+	Function: collectFromHistory()
+	Inputs  : const FrameSelection&, PointCloudT&, FrameStats&
+	Outputs : bool
+	Purpose : aggregates the newest k consecutive frames of the history, if
+	          there are that many yet
+*/
+bool collectFromHistory(const FrameSelection &selection, PointCloudT &out, FrameStats &stats){
+	//find the newest run of k frames without gaps or repeats, newest first
+	size_t start = 0;
+	size_t end = 0;
+	int run = 0;
+	for (size_t i = 0; i < frame_history.size() && run < selection.num_frames; i++){
+		const bimur_robot_vision::EncodedFrame &frame = frame_history.frame(i);
+		ros::Time stamp = pcl_conversions::fromPCL(frame.stamp);
+		if (!selection.newer_than.isZero() && stamp <= selection.newer_than){
+			stats.stale++;
+			break;
+		}
+
+		if (run > 0){
+			const bimur_robot_vision::EncodedFrame &newer = frame_history.frame(i - 1);
+			ros::Time newer_stamp = pcl_conversions::fromPCL(newer.stamp);
+			if (newer_stamp == stamp){
+				stats.duplicated++;
+				continue;
+			}
+			int missing = std::max((int)(newer.seq - frame.seq - 1), framesMissing(stamp, newer_stamp));
+			if (missing > 0){
+				stats.dropped += missing;
+				start = i;
+				run = 0;
+			}
+		}
+		run++;
+		end = i + 1;
+	}
+
+	if (run < selection.num_frames)
+		return false;
+
+	//decode oldest first, so the points are in the same order as live aggregation
+	out.clear();
+	PointCloudT decoded;
+	int used = 0;
+	for (size_t i = end; i-- > start; ){
+		frame_history.decode(i, decoded);
+		ros::Time stamp = pcl_conversions::fromPCL(decoded.header.stamp);
+		if (used > 0 && stamp == stats.last_stamp)
+			continue;
+		if (used == 0)
+			stats.first_stamp = stamp;
+		out += decoded;
+		out.header = decoded.header;
+		stats.last_stamp = stamp;
+		used++;
+	}
+	stats.used = used;
+	return true;
+}
+
+/*
+	Function: collectFrames()
+	Inputs  : const FrameSelection&, PointCloudT&, FrameStats&
+	Outputs : None
+	Purpose : gets the aggregated cloud for a request; exactly consecutive
+	          frames come from the history, unless it keeps missing frames
+*/
+void collectFrames(const FrameSelection &selection, PointCloudT &out, FrameStats &stats){
+	stats = FrameStats();
+
+	if (!selection.consecutive || (int)frame_history.capacity() < selection.num_frames){
+		waitForCloudK(selection, out, stats);
+		return;
+	}
+
+	ros::Rate r(30);
+	for (int attempts = 0; ros::ok(); attempts++){
+		ros::spinOnce();
+
+		//frames are decoded for the history on demand while a request waits for them
+		if (new_cloud_available_flag){
+			new_cloud_available_flag = false;
+			decodeLatest();
+		}
+
+		if (attempts > 2 * selection.num_frames){
+			ROS_WARN("Frame history keeps missing frames, aggregating live frames instead");
+			waitForCloudK(selection, out, stats);
+			return;
+		}
+
+		FrameStats attempt = FrameStats();
+		if (collectFromHistory(selection, out, attempt)){
+			attempt.restarts = stats.restarts;
+			stats = attempt;
+			return;
+		}
+		stats.restarts++;
+		r.sleep();
+	}
+}
+
+/*
+	Function: pointsToROSMsg()
+	Inputs  : const PointT*, size_t, const pcl::PCLHeader&, const float*, sensor_msgs::PointCloud2&
+	Outputs : None
+	Purpose : serializes a range of points with the same layout as pcl::toROSMsg,
+	          straight from the detector's buffers; with a [R | t] transform the
+	          points are transformed on the way into the message
+*/
+void pointsToROSMsg(const PointT *points, size_t size, const pcl::PCLHeader &header, const float *transform,
+                    sensor_msgs::PointCloud2 &msg){
+	pcl_conversions::fromPCL(header, msg.header);
+	msg.height = 1;
+	msg.width = size;
+	msg.fields.resize(4);
+	const char *names[4] = {"x", "y", "z", "rgb"};
+	const int offsets[4] = {offsetof(PointT, x), offsetof(PointT, y), offsetof(PointT, z), offsetof(PointT, rgb)};
+	for (int i = 0; i < 4; i++){
+		msg.fields[i].name = names[i];
+		msg.fields[i].offset = offsets[i];
+		msg.fields[i].datatype = sensor_msgs::PointField::FLOAT32;
+		msg.fields[i].count = 1;
+	}
+	msg.is_bigendian = false;
+	msg.point_step = sizeof(PointT);
+	msg.row_step = msg.point_step * size;
+	msg.is_dense = true;
+	msg.data.resize(msg.row_step);
+	if (size == 0)
+		return;
+	if (!transform){
+		memcpy(&msg.data[0], points, msg.row_step);
+		return;
+	}
+
+	const bimur_robot_vision::PointKernels &kernels = bimur_robot_vision::pointKernels();
+	uint8_t *out = &msg.data[0];
+	if (((uintptr_t)out) % 16 == 0){
+		kernels.transform(points, size, transform, reinterpret_cast<PointT *>(out));
+		return;
+	}
+
+	//the kernels need aligned points, go through a small aligned buffer otherwise
+	PointT block[64];
+	for (size_t i = 0; i < size; i += 64){
+		size_t n = std::min<size_t>(64, size - i);
+		kernels.transform(points + i, n, transform, block);
+		memcpy(out + i * sizeof(PointT), block, n * sizeof(PointT));
+	}
+}
+
+/*
+	Function: lookupTransform()
+	Inputs  : const std::string&, const pcl::PCLHeader&, float[12]
+	Outputs : bool
+	Purpose : [R | t] from the frame of the cloud to target_frame, at the
+	          stamp of the cloud
+*/
+bool lookupTransform(const std::string &target_frame, const pcl::PCLHeader &header, float matrix[12]){
+	ros::Time stamp = pcl_conversions::fromPCL(header.stamp);
+	tf::StampedTransform transform;
+	try {
+		tf_listener->waitForTransform(target_frame, header.frame_id, stamp, ros::Duration(0.5));
+		tf_listener->lookupTransform(target_frame, header.frame_id, stamp, transform);
+	} catch (tf::TransformException &ex){
+		ROS_ERROR("No transform from %s to %s: %s", header.frame_id.c_str(), target_frame.c_str(), ex.what());
+		return false;
+	}
+
+	const tf::Matrix3x3 &basis = transform.getBasis();
+	const tf::Vector3 &origin = transform.getOrigin();
+	for (int r = 0; r < 3; r++){
+		for (int c = 0; c < 3; c++)
+			matrix[4 * r + c] = basis[r][c];
+		matrix[4 * r + 3] = origin[r];
+	}
+	return true;
+}
+
+/*
+	Function: transformPlane()
+	Inputs  : const Eigen::Vector4f&, const float[12]
+	Outputs : Eigen::Vector4f
+	Purpose : the plane n.p + d = 0 moved by [R | t]: n' = R n, d' = d - n'.t
+*/
+Eigen::Vector4f transformPlane(const Eigen::Vector4f &plane, const float matrix[12]){
+	Eigen::Vector3f n(plane(0), plane(1), plane(2));
+	Eigen::Vector3f rn, t;
+	for (int r = 0; r < 3; r++){
+		rn(r) = matrix[4 * r] * n(0) + matrix[4 * r + 1] * n(1) + matrix[4 * r + 2] * n(2);
+		t(r) = matrix[4 * r + 3];
+	}
+	return Eigen::Vector4f(rn(0), rn(1), rn(2), plane(3) - rn.dot(t));
+}
+
+/*
+	Function: transformPoint()
+	Inputs  : const float[12], const Eigen::Vector3f&
+	Outputs : Eigen::Vector3f
+	Purpose : R p + t
+*/
+Eigen::Vector3f transformPoint(const float matrix[12], const Eigen::Vector3f &p){
+	return Eigen::Vector3f(matrix[0] * p(0) + matrix[1] * p(1) + matrix[2] * p(2) + matrix[3],
+	                       matrix[4] * p(0) + matrix[5] * p(1) + matrix[6] * p(2) + matrix[7],
+	                       matrix[8] * p(0) + matrix[9] * p(1) + matrix[10] * p(2) + matrix[11]);
+}
+
+/*
+	Function: gridToROSMsg()
+	Inputs  : const TableGrid&, const pcl::PCLHeader&, const float*, nav_msgs::OccupancyGrid&
+	Outputs : None
+	Purpose : the table grid as an occupancy grid whose origin pose lies in the
+	          table plane, optionally moved by a [R | t] transform
+*/
+void gridToROSMsg(const bimur_robot_vision::TableGrid &grid, const pcl::PCLHeader &header, const float *transform,
+                  nav_msgs::OccupancyGrid &msg){
+	pcl_conversions::fromPCL(header, msg.header);
+	msg.info.map_load_time = msg.header.stamp;
+	msg.info.resolution = grid.resolution();
+	msg.info.width = grid.width();
+	msg.info.height = grid.height();
+
+	Eigen::Vector3f origin = grid.origin();
+	Eigen::Matrix3f axes = grid.axes();
+	if (transform){
+		Eigen::Matrix3f rotation;
+		for (int r = 0; r < 3; r++)
+			rotation.row(r) = Eigen::Vector3f(transform[4 * r], transform[4 * r + 1], transform[4 * r + 2]);
+		origin = transformPoint(transform, origin);
+		axes = rotation * axes;
+	}
+	Eigen::Quaternionf orientation(axes);
+	msg.info.origin.position.x = origin.x();
+	msg.info.origin.position.y = origin.y();
+	msg.info.origin.position.z = origin.z();
+	msg.info.origin.orientation.x = orientation.x();
+	msg.info.origin.orientation.y = orientation.y();
+	msg.info.origin.orientation.z = orientation.z();
+	msg.info.origin.orientation.w = orientation.w();
+
+	msg.data.assign(grid.cells().begin(), grid.cells().end());
+}
+
+/*
+	Function: publishCollisionObjects()
+	Inputs  : const bimur_robot_vision::ObjectPrimitives&, const std::vector<int>&
+	Outputs : None
+	Purpose : publishes a primitive shape per object of the last detection,
+	          replacing the shapes of the same objects and removing the
+	          shapes of objects that are gone
+*/
+void publishCollisionObjects(const bimur_robot_vision::ObjectPrimitives &primitives, const std::vector<int> &removed){
+	pcl::PCLHeader header = detection_header;
+	float transform[12];
+	bool transformed = false;
+	if (!collision_frame.empty() && collision_frame != header.frame_id){
+		if (!lookupTransform(collision_frame, header, transform)){
+			ROS_WARN("Collision objects not published");
+			return;
+		}
+		header.frame_id = collision_frame;
+		transformed = true;
+	}
+	Eigen::Matrix3f rotation = Eigen::Matrix3f::Identity();
+	if (transformed){
+		for (int r = 0; r < 3; r++)
+			rotation.row(r) = Eigen::Vector3f(transform[4 * r], transform[4 * r + 1], transform[4 * r + 2]);
+	}
+
+	moveit_msgs::CollisionObject object;
+	pcl_conversions::fromPCL(header, object.header);
+	for (size_t i = 0; i < primitives.size(); i++){
+		const bimur_robot_vision::ObjectPrimitive &primitive = primitives[i];
+		object.id = "bimur_object_" + std::to_string(primitive.id);
+		object.operation = moveit_msgs::CollisionObject::ADD;
+
+		shape_msgs::SolidPrimitive shape;
+		if (primitive.type == bimur_robot_vision::PRIMITIVE_CYLINDER){
+			shape.type = shape_msgs::SolidPrimitive::CYLINDER;
+			shape.dimensions.resize(2);
+			shape.dimensions[shape_msgs::SolidPrimitive::CYLINDER_HEIGHT] = primitive.dimensions(0);
+			shape.dimensions[shape_msgs::SolidPrimitive::CYLINDER_RADIUS] = primitive.dimensions(1);
+		} else {
+			shape.type = shape_msgs::SolidPrimitive::BOX;
+			shape.dimensions.resize(3);
+			shape.dimensions[shape_msgs::SolidPrimitive::BOX_X] = primitive.dimensions(0);
+			shape.dimensions[shape_msgs::SolidPrimitive::BOX_Y] = primitive.dimensions(1);
+			shape.dimensions[shape_msgs::SolidPrimitive::BOX_Z] = primitive.dimensions(2);
+		}
+
+		Eigen::Vector3f centre = transformed ? transformPoint(transform, primitive.centre) : primitive.centre;
+		Eigen::Quaternionf orientation(rotation * primitive.orientation.toRotationMatrix());
+		geometry_msgs::Pose pose;
+		pose.position.x = centre.x();
+		pose.position.y = centre.y();
+		pose.position.z = centre.z();
+		pose.orientation.x = orientation.x();
+		pose.orientation.y = orientation.y();
+		pose.orientation.z = orientation.z();
+		pose.orientation.w = orientation.w();
+
+		object.primitives.assign(1, shape);
+		object.primitive_poses.assign(1, pose);
+		collision_pub.publish(object);
+	}
+
+	object.primitives.clear();
+	object.primitive_poses.clear();
+	object.operation = moveit_msgs::CollisionObject::REMOVE;
+	for (size_t i = 0; i < removed.size(); i++){
+		object.id = "bimur_object_" + std::to_string(removed[i]);
+		collision_pub.publish(object);
+	}
+
+	ROS_INFO("Collision objects: %i updated, %i removed", (int)primitives.size(), (int)removed.size());
+}
+
+/*
+	Function: trackDetection()
+	Inputs  : bool
+	Outputs : None
+	Purpose : gives the objects of the last detection their ids, then
+	          publishes their collision objects and records the detection.
+	          Objects not seen again are only removed after a complete
+	          detection (a plane, every object returned).
+*/
+void trackDetection(bool complete){
+	if (!collision_objects_mode && detection_history.capacity() == 0 && detection_history.spillPath().empty())
+		return;
+
+	bimur_robot_vision::ObjectPrimitives primitives;
+	std::vector<int> removed;
+	bimur_robot_vision::fitPrimitives(detection, 0.7f, primitives);
+	if (complete)
+		primitive_tracker.update(primitives, removed);
+	else
+		primitive_tracker.match(primitives);
+
+	if (collision_objects_mode)
+		publishCollisionObjects(primitives, removed);
+
+	bimur_robot_vision::DetectionSummary summary;
+	bimur_robot_vision::summarizeDetection(detection, primitives, detection_header.stamp, summary);
+	double stamp = pcl_conversions::fromPCL(detection_header.stamp).toSec();
+	if (!detection_history.add(summary))
+		ROS_WARN("Detection at %f not recorded in the history", stamp);
+	if (!detection_history.lastSpilled())
+		ROS_WARN_THROTTLE(10, "Detection at %f not written to the detection history file %s", stamp,
+		                  detection_history_file.c_str());
 }
 
 /*
@@ -298,142 +995,116 @@ void waitForCloudK(int k){
 bool seg_cb(bimur_robot_vision::TabletopPerception::Request &req, bimur_robot_vision::TabletopPerception::Response &res)
 {
 	//get the point cloud by aggregating k successive input clouds
-	waitForCloudK(15);
-	cloud = cloud_aggregated;
-
-	//**Step 1: z-filter and voxel filter**//
-	
-	// Create the filtering object
-	pcl::PassThrough<PointT> pass;
-	pass.setInputCloud (cloud);
-	pass.setFilterFieldName ("z");
-	pass.setFilterLimits (0.0, 1.0);
-	pass.filter (*cloud);
-	
-	// Create the filtering object: downsample the dataset using a leaf size of 1cm
-	pcl::VoxelGrid<PointT> vg;
-	pcl::PointCloud<PointT>::Ptr cloud_filtered (new pcl::PointCloud<PointT>);
-	vg.setInputCloud (cloud);
-	vg.setLeafSize (0.005f, 0.005f, 0.005f);
-	vg.filter (*cloud_filtered);
-
-	
+	FrameSelection selection;
+	selection.num_frames = req.num_frames > 0 ? req.num_frames : 15;
+	selection.newer_than = req.newer_than;
+	selection.consecutive = req.consecutive;
+
+	FrameStats stats;
+	collectFrames(selection, *cloud_aggregated, stats);
+	//a local name, the global cloud keeps receiving frames from cloud_cb
+	PointCloudT::Ptr cloud = cloud_aggregated;
+
+	res.frames_used = stats.used;
+	res.frames_dropped = stats.dropped;
+	res.frames_duplicated = stats.duplicated;
+	res.frames_stale = stats.stale;
+	res.frames_restarts = stats.restarts;
+	res.first_stamp = stats.first_stamp;
+	res.last_stamp = stats.last_stamp;
+
+	ROS_INFO("Aggregated %i frames (%i dropped, %i duplicated, %i stale, %i restarts)",
+	         stats.used, stats.dropped, stats.duplicated, stats.stale, stats.restarts);
+	ROS_INFO("Ingested %lu frames: %lu decoded, %lu superseded, %lu late, %lu over the decode budget, "
+	         "%lu lost in transport, %lu resets", ingest.received, ingest.decoded, ingest.superseded, ingest.late,
+	         ingest.over_budget, ingest.lost, ingest.resets);
+	if (stats.dropped > 0 || stats.duplicated > 0)
+		ROS_WARN("Frames were dropped or duplicated during aggregation");
+
+	bimur_robot_vision::DetectOptions options;
+	options.full_resolution = req.full_resolution;
+	options.max_objects = req.max_objects;
+	if (req.rank_by == "distance")
+		options.rank_by = bimur_robot_vision::RANK_BY_DISTANCE;
+	else if (req.rank_by == "height")
+		options.rank_by = bimur_robot_vision::RANK_BY_HEIGHT;
+	options.reference_point = Eigen::Vector3f(req.reference_point.x, req.reference_point.y, req.reference_point.z);
+	options.table_grid_resolution = table_grid_resolution;
+	options.levels_of_detail = req.lod_level > 0 || req.max_points_per_cluster > 0;
+
+	//z filter, voxel grid, plane fitting, clustering and plane check
+	detector.detect(*cloud, options, detection);
+	detection_header = cloud->header;
+
+	ROS_INFO("After voxel grid filter: %i points",(int)detection.num_filtered);
+
+	//the response can be in any frame, transformed while it is serialized
+	pcl::PCLHeader out_header = cloud->header;
+	float transform[12];
+	const float *out_transform = NULL;
+	if (!req.target_frame.empty() && req.target_frame != cloud->header.frame_id){
+		if (!lookupTransform(req.target_frame, cloud->header, transform))
+			return false;
+		out_header.frame_id = req.target_frame;
+		out_transform = transform;
+	}
 
-	
+	trackDetection(req.max_objects <= 0 && detection.is_plane_found);
 
-    ROS_INFO("After voxel grid filter: %i points",(int)cloud_filtered->points.size());
-    
-    //**Step 2: plane fitting**//
-    
-    //find plane
-    //one cloud contains plane other cloud contains other objects
-    pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients ());
-	pcl::PointIndices::Ptr inliers (new pcl::PointIndices ());
-    // Create the segmentation object
-	pcl::SACSegmentation<PointT> seg;
-	// Optional
-    seg.setOptimizeCoefficients (true);
-	// Mandatory
-	seg.setModelType (pcl::SACMODEL_PLANE);
-	seg.setMethodType (pcl::SAC_RANSAC);
-	seg.setMaxIterations (1000);
-	seg.setDistanceThreshold (0.02);
-
-	// Create the filtering object
-	pcl::ExtractIndices<PointT> extract;
-
-	// Segment the largest planar component from the remaining cloud
-	seg.setInputCloud (cloud_filtered);
-	seg.segment (*inliers, *coefficients);
-
-	// Extract the plane
-	extract.setInputCloud (cloud_filtered);
-	extract.setIndices (inliers);
-	extract.setNegative (false);
-	extract.filter (*cloud_plane);
-
-	if(cloud_plane->empty()){
+	if(!detection.is_plane_found){
 		res.is_plane_found = false;
 		return true;
 	}
-	     
-    //for everything else, cluster extraction; segment extraction
-    //extract everything else
-	extract.setNegative (true);
-	extract.filter (*cloud_blobs);
 
 	//publish point cloud for debugging
 	ROS_INFO("Publishing point cloud...");
-	pcl::toROSMsg(*cloud_blobs,cloud_ros);
+	pcl::toROSMsg(detection.blobs,cloud_ros);
 	cloud_ros.header.frame_id = cloud->header.frame_id;
 	cloud_pub.publish(cloud_ros);
-	
-    //get the plane coefficients
-	Eigen::Vector4f plane_coefficients;
-	plane_coefficients(0)=coefficients->values[0] + 0.1;
-	plane_coefficients(1)=coefficients->values[1] + 0.5;
-	plane_coefficients(2)=coefficients->values[2] + 0.1;
-	plane_coefficients(3)=coefficients->values[3];
-
-    	
-    //**Step 3: Eucledian Cluster Extraction**//
-	std::vector<PointCloudT::Ptr > clusters = computeClusters(cloud_blobs,0.04);
-	
-	ROS_INFO("clustes found: %i", (int)clusters.size());
-	
-	clusters_on_plane.clear();
-
-	//creates a box contraint and filters out noise outside of specified box based on the found plane for max values
-	pcl::CropBox<pcl::PointXYZRGB> boxFilter;
-	boxFilter.setMin(Eigen::Vector4f(0, 0, 0, 1.0));
-	boxFilter.setMax(plane_coefficients);
-	boxFilter.setInputCloud(cloud_filtered);
-	boxFilter.filter(*cloud_plane);
-
-	
-	//if clusters are touching the table put them in a vector
-	for (unsigned int i = 0; i < clusters.size(); i++){
-
 
-		bool accept = filter(clusters.at(i),plane_coefficients,plane_distance_tolerance);
-		if (accept)
-		{
-			clusters_on_plane.push_back(clusters.at(i));
-		}
+	ROS_INFO("clustes found: %i", (int)detection.num_candidates);
 
+	for (unsigned int i = 0; i < detection.clusters.size(); i++){
+		const bimur_robot_vision::ClusterView &view = detection.clusters.at(i);
+		ROS_INFO("\nMin Distance to plane for cluster with %i points: %f",view.aggregate.count,view.min_plane_distance);
+		ROS_INFO("Max Distance to plane for cluster with %i points: %f",view.aggregate.count,view.max_plane_distance);
 	}
 
-
-	ROS_INFO("clustes_on_plane found: %i", (int)clusters_on_plane.size());
+	ROS_INFO("clustes_on_plane found: %i", (int)detection.clusters.size());
 
 	res.is_plane_found = true;
 	
 	//fill in responses
 	//plane cloud and coefficient
-	pcl::toROSMsg(*cloud_plane,res.cloud_plane);
-	res.cloud_plane.header.frame_id = cloud->header.frame_id;
+	pointsToROSMsg(detection.plane.points.empty() ? NULL : &detection.plane.points[0], detection.plane.points.size(),
+	               out_header, out_transform, res.cloud_plane);
+	Eigen::Vector4f plane_coefficients = detection.plane_coefficients;
+	if (out_transform){
+		//the same offset as in the camera frame, on top of the moved plane
+		plane_coefficients = transformPlane(detection.plane_model, out_transform) +
+		                     (detection.plane_coefficients - detection.plane_model);
+	}
 	for (int i = 0; i < 4; i ++){
 		res.cloud_plane_coef[i] = plane_coefficients(i);
 	}
 
+	//free and occupied table cells
+	if (req.table_grid && !detection.table_grid.empty())
+		gridToROSMsg(detection.table_grid, out_header, out_transform, res.table_grid);
+
 	//blobs on the plane
-	for (unsigned int i = 0; i < clusters_on_plane.size(); i++){
-		pcl::toROSMsg(*clusters_on_plane.at(i),cloud_ros);
-		cloud_ros.header.frame_id = cloud->header.frame_id;
-		res.cloud_clusters.push_back(cloud_ros);
+	res.cloud_clusters.resize(detection.clusters.size());
+	//each cluster is ordered coarse to fine, a level of detail is a prefix of it
+	for (unsigned int i = 0; i < detection.clusters.size(); i++){
+		size_t lod_size = detection.clusters.at(i).lodPrefix(req.lod_level, req.max_points_per_cluster);
+		pointsToROSMsg(detection.clusterBegin(i), lod_size, out_header, out_transform, res.cloud_clusters.at(i));
 	}
 	
 	cloud_mutex.unlock ();
 
 	//for debugging purposes
-	cloud_blobs->clear();
-
-	for (unsigned int i = 0; i < clusters_on_plane.size(); i++){
-		*cloud_blobs += *clusters_on_plane.at(i);
-	}
-	
 	ROS_INFO("Publishing debug cloud...");
-	pcl::toROSMsg(*cloud_blobs,cloud_ros);
+	pcl::toROSMsg(detection.cluster_points,cloud_ros);
 	cloud_ros.header.frame_id = cloud->header.frame_id;
 	cloud_pub.publish(cloud_ros);
 
@@ -441,6 +1112,211 @@ bool seg_cb(bimur_robot_vision::TabletopPerception::Request &req, bimur_robot_vi
 }
 
 
+/*
+	Function: place_cb()
+	Inputs  : bimur_robot_vision::TablePlacement::Request &req, bimur_robot_vision::TablePlacement::Response &res
+	Outputs : bool
+	Purpose : free spots on the table from the occupancy grid of the last
+	          detection, or of a new one
+*/
+bool place_cb(bimur_robot_vision::TablePlacement::Request &req, bimur_robot_vision::TablePlacement::Response &res)
+{
+	if (table_grid_resolution <= 0.0){
+		ROS_ERROR("Placement queries need table_grid_resolution > 0");
+		return false;
+	}
+
+	if (req.refresh || detection.table_grid.empty()){
+		FrameSelection selection;
+		selection.num_frames = 15;
+		selection.consecutive = false;
+		FrameStats stats;
+		collectFrames(selection, *cloud_aggregated, stats);
+
+		bimur_robot_vision::DetectOptions options;
+		options.table_grid_resolution = table_grid_resolution;
+		detector.detect(*cloud_aggregated, options, detection);
+		detection_header = cloud_aggregated->header;
+		trackDetection(detection.is_plane_found);
+	}
+
+	res.is_table_found = !detection.table_grid.empty();
+	if (!res.is_table_found)
+		return true;
+
+	pcl::PCLHeader out_header = detection_header;
+	float transform[12];
+	const float *out_transform = NULL;
+	if (!req.target_frame.empty() && req.target_frame != detection_header.frame_id){
+		if (!lookupTransform(req.target_frame, detection_header, transform))
+			return false;
+		out_header.frame_id = req.target_frame;
+		out_transform = transform;
+	}
+	pcl_conversions::fromPCL(out_header, res.header);
+
+	std::vector<bimur_robot_vision::Placement> placements;
+	detection.table_grid.findPlacements(req.radius, req.max_placements > 0 ? req.max_placements : 5, placements);
+
+	res.positions.resize(placements.size());
+	res.clearances.resize(placements.size());
+	for (size_t i = 0; i < placements.size(); i++){
+		Eigen::Vector3f p = out_transform ? transformPoint(out_transform, placements[i].point) : placements[i].point;
+		res.positions[i].x = p.x();
+		res.positions[i].y = p.y();
+		res.positions[i].z = p.z();
+		res.clearances[i] = placements[i].clearance;
+	}
+
+	Eigen::Vector3f normal = detection.table_grid.axes().col(2);
+	if (out_transform)
+		normal = transformPoint(out_transform, normal) - transformPoint(out_transform, Eigen::Vector3f::Zero());
+	res.normal.x = normal.x();
+	res.normal.y = normal.y();
+	res.normal.z = normal.z();
+
+	ROS_INFO("%i placement(s) with radius %f", (int)placements.size(), req.radius);
+	return true;
+}
+
+
+/*
+	Function: presence_cb()
+	Inputs  : bimur_robot_vision::TablePresence::Request &req, bimur_robot_vision::TablePresence::Response &res
+	Outputs : bool
+	Purpose : counts the objects on the table in the latest frame, against the
+	          table of the last detection; no frames are aggregated
+*/
+bool presence_cb(bimur_robot_vision::TablePresence::Request &req, bimur_robot_vision::TablePresence::Response &res)
+{
+	if (table_grid_resolution <= 0.0){
+		ROS_ERROR("Presence queries need table_grid_resolution > 0");
+		return false;
+	}
+
+	if (!latest_msg && !latest_depth)
+		waitForCloud();
+	decodeLatest();
+
+	//the table is only looked for once, on a single frame
+	if (detection.table_grid.empty()){
+		bimur_robot_vision::DetectOptions options;
+		options.table_grid_resolution = table_grid_resolution;
+		detector.detect(*cloud, options, detection);
+		detection_header = cloud->header;
+		trackDetection(detection.is_plane_found);
+	}
+
+	res.is_table_known = !detection.table_grid.empty();
+	res.stamp = pcl_conversions::fromPCL(cloud->header.stamp);
+	if (!res.is_table_known)
+		return true;
+
+	bimur_robot_vision::PresenceParams params;
+	if (req.min_height > 0.0f)
+		params.min_height = req.min_height;
+	if (req.min_object_points > 0)
+		params.min_object_points = req.min_object_points;
+	table_presence.setParams(params);
+
+	ros::WallTime start = ros::WallTime::now();
+	table_presence.count(cloud->points.empty() ? NULL : &cloud->points[0], cloud->points.size(),
+	                     detection.table_grid, presence);
+
+	res.num_objects = presence.numObjects();
+	res.is_empty = presence.empty();
+	res.object_points.assign(presence.object_points.begin(), presence.object_points.end());
+	res.num_points_above = presence.num_points_above;
+	res.height_bin = params.histogram_bin;
+	res.height_histogram.assign(presence.height_histogram.begin(), presence.height_histogram.end());
+
+	ROS_DEBUG("Presence: %i object(s) in %f ms", res.num_objects, (ros::WallTime::now() - start).toSec() * 1000.0);
+	return true;
+}
+
+
+/*
+	Function: appendSummary()
+	Inputs  : const bimur_robot_vision::DetectionSummary&, bimur_robot_vision::DetectionHistoryQuery::Response&
+	Outputs : None
+	Purpose : adds a detection to the columns of a history response
+*/
+void appendSummary(const bimur_robot_vision::DetectionSummary &summary, bimur_robot_vision::DetectionHistoryQuery::Response &res){
+	res.stamps.push_back(pcl_conversions::fromPCL(summary.stamp));
+	res.is_plane_found.push_back(summary.is_plane_found);
+	res.plane_coef.insert(res.plane_coef.end(), summary.plane, summary.plane + 4);
+	for (size_t j = 0; j < summary.objects.size(); j++){
+		const bimur_robot_vision::ObjectSummary &object = summary.objects[j];
+		res.object_ids.push_back(object.id);
+		res.object_types.push_back(object.type == bimur_robot_vision::PRIMITIVE_CYLINDER ?
+		                           shape_msgs::SolidPrimitive::CYLINDER : shape_msgs::SolidPrimitive::BOX);
+		res.object_points.push_back(object.points);
+		geometry_msgs::Point centroid;
+		centroid.x = object.centroid[0];
+		centroid.y = object.centroid[1];
+		centroid.z = object.centroid[2];
+		res.object_centroids.push_back(centroid);
+		geometry_msgs::Vector3 dimensions;
+		dimensions.x = object.dimensions[0];
+		dimensions.y = object.dimensions[1];
+		dimensions.z = object.dimensions[2];
+		res.object_dimensions.push_back(dimensions);
+		res.object_rgb.push_back(object.rgb);
+	}
+	res.object_offsets.push_back(res.object_ids.size());
+}
+
+/*
+	Function: history_cb()
+	Inputs  : bimur_robot_vision::DetectionHistoryQuery::Request &req, bimur_robot_vision::DetectionHistoryQuery::Response &res
+	Outputs : bool
+	Purpose : summaries of the detections within a time range, from memory
+	          and, for older ones, from the spill file
+*/
+bool history_cb(bimur_robot_vision::DetectionHistoryQuery::Request &req, bimur_robot_vision::DetectionHistoryQuery::Response &res)
+{
+	ros::WallTime start = ros::WallTime::now();
+
+	uint64_t begin, end;
+	pcl_conversions::toPCL(req.begin, begin);
+	pcl_conversions::toPCL(req.end, end);
+	if (req.end.isZero())
+		end = std::numeric_limits<uint64_t>::max();
+	size_t max_results = req.max_results > 0 ? (size_t)req.max_results : 0;
+
+	uint64_t oldest = detection_history.empty() ? 0 : detection_history.stamp(0);
+	if (!detection_history.empty())
+		res.oldest = pcl_conversions::fromPCL(oldest);
+	res.object_offsets.push_back(0);
+
+	//what left memory is only in the spill file
+	if (req.include_spilled && !detection_history.spillPath().empty() && (detection_history.empty() || begin < oldest)){
+		std::vector<bimur_robot_vision::DetectionSummary> spilled;
+		uint64_t spilled_end = detection_history.empty() ? end : std::min(end, oldest - 1);
+		if (!bimur_robot_vision::DetectionHistory::readSpilled(detection_history.spillPath(), begin, spilled_end,
+		                                                       max_results, spilled)){
+			ROS_ERROR("Cannot read the detection history file %s", detection_history.spillPath().c_str());
+			return false;
+		}
+		for (size_t i = 0; i < spilled.size(); i++)
+			appendSummary(spilled[i], res);
+	}
+
+	size_t first, last;
+	detection_history.range(begin, end, first, last);
+	if (max_results > 0)
+		last = std::min(last, first + (max_results > res.stamps.size() ? max_results - res.stamps.size() : 0));
+	bimur_robot_vision::DetectionSummary summary;
+	for (size_t i = first; i < last; i++){
+		detection_history.get(i, summary);
+		appendSummary(summary, res);
+	}
+
+	ROS_DEBUG("History: %i detection(s) in %f ms", (int)res.stamps.size(), (ros::WallTime::now() - start).toSec() * 1000.0);
+	return true;
+}
+
+
 /*
 
 	Just Main
@@ -452,18 +1328,67 @@ int main (int argc, char** argv)
 	ros::init (argc, argv, "bimur_object_detector");
 	ros::NodeHandle nh;
 
-	// Create a ROS subscriber for the input point cloud
+	ros::NodeHandle pnh("~");
+
+	// Create a ROS subscriber for the input point cloud, or for the depth image it is made from
 	std::string param_topic = "/camera/depth/color/points"; 
-	ros::Subscriber sub = nh.subscribe (param_topic, 1, cloud_cb);
+	std::string depth_topic = "/camera/depth/image_raw";
+	std::string camera_info_topic = "/camera/depth/camera_info";
+	std::string rgb_topic;
+	pnh.param("depth_input", depth_input_mode, depth_input_mode);
+	pnh.param("depth_topic", depth_topic, depth_topic);
+	pnh.param("camera_info_topic", camera_info_topic, camera_info_topic);
+	pnh.param("rgb_topic", rgb_topic, rgb_topic);
+	pnh.param("queue_size", queue_size, queue_size);
+	pnh.param("late_tolerance", late_tolerance, late_tolerance);
+	ros::Subscriber sub, info_sub, rgb_sub;
+	if (depth_input_mode){
+		sub = nh.subscribe (depth_topic, std::max(queue_size, 1), depth_cb);
+		info_sub = nh.subscribe (camera_info_topic, 1, camera_info_cb);
+		if (!rgb_topic.empty())
+			rgb_sub = nh.subscribe (rgb_topic, 1, rgb_cb);
+	} else {
+		sub = nh.subscribe (param_topic, std::max(queue_size, 1), cloud_cb);
+	}
 
 	//debugging publisher
 	cloud_pub = nh.advertise<sensor_msgs::PointCloud2>("bimur_object_detector/cloud", 10);
+	collision_pub = nh.advertise<moveit_msgs::CollisionObject>("bimur_object_detector/collision_object", 100);
+
+	pnh.param("incremental_clustering", incremental_clustering_mode, incremental_clustering_mode);
+	bimur_robot_vision::DetectorParams detector_params;
+	detector_params.incremental_clustering = incremental_clustering_mode;
+	detector_params.plane_distance_tolerance = plane_distance_tolerance;
+	detector.setParams(detector_params);
+	//the z and region of interest limits are applied while unprojecting
+	const float limits_lo[3] = {detector_params.x_min, detector_params.y_min, detector_params.z_min};
+	const float limits_hi[3] = {detector_params.x_max, detector_params.y_max, detector_params.z_max};
+	unprojector.setLimits(limits_lo, limits_hi);
+	pnh.param("history_size", history_size, history_size);
+	pnh.param("max_restarts", max_restarts, max_restarts);
+	frame_history.setCapacity(std::max(history_size, 0));
+	pnh.param("table_grid_resolution", table_grid_resolution, table_grid_resolution);
+	pnh.param("decode_budget", decode_budget, decode_budget);
+	pnh.param("collision_objects", collision_objects_mode, collision_objects_mode);
+	pnh.param("collision_frame", collision_frame, collision_frame);
+	pnh.param("detection_history_size", detection_history_size, detection_history_size);
+	pnh.param("detection_history_file", detection_history_file, detection_history_file);
+	//room for 16 objects per detection on average
+	detection_history.setCapacity(std::max(detection_history_size, 0), 16 * (size_t)std::max(detection_history_size, 0));
+	if (!detection_history.spillTo(detection_history_file))
+		ROS_ERROR("Cannot append to the detection history file %s", detection_history_file.c_str());
 
 	//service
 	ros::ServiceServer service = nh.advertiseService("bimur_object_detector/detect", seg_cb); 
+	ros::ServiceServer place_service = nh.advertiseService("bimur_object_detector/place", place_cb);
+	ros::ServiceServer presence_service = nh.advertiseService("bimur_object_detector/presence", presence_cb);
+	ros::ServiceServer history_service = nh.advertiseService("bimur_object_detector/history", history_cb);
 	
 	
 	tf::TransformListener listener;
+	tf_listener = &listener;
+	//scripts/measure_startup.sh takes the startup time from the stamp of this line
+	ROS_INFO("bimur_object_detector ready");
 
 	//register ctrl-c
 	signal(SIGINT, sig_handler);
@@ -22,7 +22,6 @@
 #include <pcl/point_cloud.h>
 #include <pcl/console/parse.h>
 #include <pcl/point_types.h>
-#include <pcl/io/openni_grabber.h>
 #include <pcl/sample_consensus/sac_model_plane.h>
 #include <pcl/common/time.h>
 #include <pcl/common/common.h>
@@ -0,0 +1,179 @@
+/*
+	Scalar reference point kernels and run-time dispatch, see point_kernels.h
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "bimur_robot_vision/point_kernels.h"
+#include "point_kernels_impl.h"
+
+namespace bimur_robot_vision
+{
+
+#ifdef BIMUR_VISION_X86_KERNELS
+const PointKernels &sse42PointKernels();
+const PointKernels &avx2PointKernels();
+const PointKernels &avx512PointKernels();
+#endif
+
+static void scalarPlaneDistanceRange(const pcl::PointXYZRGB *points, size_t size, const float plane[4],
+                                     float *min_distance, float *max_distance){
+	const float inv_norm = 1.0f / std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+	const float a = plane[0] * inv_norm, b = plane[1] * inv_norm, c = plane[2] * inv_norm, d = plane[3] * inv_norm;
+
+	float lo = FLT_MAX;
+	float hi = -FLT_MAX;
+	for (size_t i = 0; i < size; i++){
+		const pcl::PointXYZRGB &p = points[i];
+		float distance = std::fabs(a * p.x + b * p.y + c * p.z + d);
+		if (distance < lo)
+			lo = distance;
+		if (distance > hi)
+			hi = distance;
+	}
+	*min_distance = lo;
+	*max_distance = hi;
+}
+
+static void scalarBoundingBox(const pcl::PointXYZRGB *points, size_t size, float min[3], float max[3]){
+	min[0] = min[1] = min[2] = FLT_MAX;
+	max[0] = max[1] = max[2] = -FLT_MAX;
+	for (size_t i = 0; i < size; i++){
+		const pcl::PointXYZRGB &p = points[i];
+		if (p.x < min[0]) min[0] = p.x;
+		if (p.y < min[1]) min[1] = p.y;
+		if (p.z < min[2]) min[2] = p.z;
+		if (p.x > max[0]) max[0] = p.x;
+		if (p.y > max[1]) max[1] = p.y;
+		if (p.z > max[2]) max[2] = p.z;
+	}
+}
+
+static void scalarColourSums(const pcl::PointXYZRGB *points, size_t size, uint64_t sums[3]){
+	sums[0] = sums[1] = sums[2] = 0;
+	for (size_t i = 0; i < size; i++){
+		sums[0] += points[i].r;
+		sums[1] += points[i].g;
+		sums[2] += points[i].b;
+	}
+}
+
+static size_t scalarCrop(const pcl::PointXYZRGB *points, size_t size, const float lo[3], const float hi[3],
+                         pcl::PointXYZRGB *out){
+	size_t n = 0;
+	for (size_t i = 0; i < size; i++){
+		const pcl::PointXYZRGB &p = points[i];
+		//written so that NaN fails every comparison
+		if (p.x >= lo[0] && p.x <= hi[0] && p.y >= lo[1] && p.y <= hi[1] && p.z >= lo[2] && p.z <= hi[2]){
+			if (out + n != points + i)
+				out[n] = p;
+			n++;
+		}
+	}
+	return n;
+}
+
+static void scalarUnpackRgb(const pcl::PointXYZRGB *points, size_t size, uint8_t *rgb){
+	for (size_t i = 0; i < size; i++){
+		rgb[3 * i] = points[i].r;
+		rgb[3 * i + 1] = points[i].g;
+		rgb[3 * i + 2] = points[i].b;
+	}
+}
+
+static void scalarTransform(const pcl::PointXYZRGB *points, size_t size, const float matrix[12],
+                            pcl::PointXYZRGB *out){
+	const float *m = matrix;
+	for (size_t i = 0; i < size; i++){
+		const pcl::PointXYZRGB &p = points[i];
+		float x = m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3];
+		float y = m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7];
+		float z = m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11];
+		if (out + i != points + i)
+			out[i] = p;
+		out[i].x = x;
+		out[i].y = y;
+		out[i].z = z;
+		out[i].data[3] = 1.0f;
+	}
+}
+
+static size_t scalarUnproject(const uint16_t *depth, const float *ray_x, const float *ray_y, size_t size, float scale,
+                               const uint8_t *rgb, const float lo[3], const float hi[3], pcl::PointXYZRGB *out){
+	const float z_lo = std::max(lo[2], FLT_MIN);
+	size_t n = 0;
+	for (size_t i = 0; i < size; i++){
+		float z = depth[i] * scale;
+		float x = z * ray_x[i];
+		float y = z * ray_y[i];
+		if (x >= lo[0] && x <= hi[0] && y >= lo[1] && y <= hi[1] && z >= z_lo && z <= hi[2]){
+			storeUnprojected(out[n++], x, y, z, rgb ? rgb + 3 * i : NULL);
+		}
+	}
+	return n;
+}
+
+const PointKernels &scalarPointKernels(){
+	static const PointKernels kernels = {
+		"scalar",
+		&scalarPlaneDistanceRange,
+		&scalarBoundingBox,
+		&scalarColourSums,
+		&scalarCrop,
+		&scalarUnpackRgb,
+		&scalarTransform,
+		&scalarUnproject
+	};
+	return kernels;
+}
+
+const PointKernels *pointKernelsByName(const char *name){
+	if (strcmp(name, "scalar") == 0)
+		return &scalarPointKernels();
+
+#ifdef BIMUR_VISION_X86_KERNELS
+	__builtin_cpu_init();
+	if (strcmp(name, "sse42") == 0 && __builtin_cpu_supports("sse4.2"))
+		return &sse42PointKernels();
+	if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return &avx2PointKernels();
+	if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f"))
+		return &avx512PointKernels();
+#endif
+
+	return NULL;
+}
+
+/*
+	Function: selectPointKernels()
+	Inputs  : None
+	Outputs : const PointKernels&
+	Purpose : widest supported kernels, unless BIMUR_VISION_KERNELS names others
+*/
+static const PointKernels &selectPointKernels(){
+	const char *forced = getenv("BIMUR_VISION_KERNELS");
+	if (forced){
+		const PointKernels *k = pointKernelsByName(forced);
+		if (k)
+			return *k;
+	}
+
+	const char *order[] = {"avx512", "avx2", "sse42"};
+	for (int i = 0; i < 3; i++){
+		const PointKernels *k = pointKernelsByName(order[i]);
+		if (k)
+			return *k;
+	}
+	return scalarPointKernels();
+}
+
+const PointKernels &pointKernels(){
+	static const PointKernels &kernels = selectPointKernels();
+	return kernels;
+}
+
+}
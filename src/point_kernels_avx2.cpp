@@ -0,0 +1,126 @@
+/*
+	AVX2 point kernels (8 points per step), compiled with -mavx2 -mfma
+*/
+
+#include <immintrin.h>
+
+#include "point_kernels_impl.h"
+
+namespace bimur_robot_vision
+{
+
+namespace
+{
+
+struct Avx2
+{
+	typedef __m256 F;
+	typedef __m256i I;
+	enum { width = 8 };
+
+	static inline F set1(float v){ return _mm256_set1_ps(v); }
+	static inline F min(F a, F b){ return _mm256_min_ps(a, b); }
+	static inline F max(F a, F b){ return _mm256_max_ps(a, b); }
+	static inline F abs(F a){ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	static inline F mul(F a, F b){ return _mm256_mul_ps(a, b); }
+	static inline F fmadd(F a, F b, F c){ return _mm256_fmadd_ps(a, b, c); }
+
+	static inline F loadF(const float *p){ return _mm256_loadu_ps(p); }
+	static inline void storeF(float *p, F v){ _mm256_storeu_ps(p, v); }
+	static inline F loadDepth(const uint16_t *p){
+		return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)p)));
+	}
+
+	static inline void loadXYZ(const KernelPointT *p, F &x, F &y, F &z){
+		//two 4x4 transposes of the leading x, y, z, pad of every point
+		__m128 a0 = _mm_load_ps(p[0].data), a1 = _mm_load_ps(p[1].data);
+		__m128 a2 = _mm_load_ps(p[2].data), a3 = _mm_load_ps(p[3].data);
+		__m128 b0 = _mm_load_ps(p[4].data), b1 = _mm_load_ps(p[5].data);
+		__m128 b2 = _mm_load_ps(p[6].data), b3 = _mm_load_ps(p[7].data);
+		_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+		_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+		x = _mm256_insertf128_ps(_mm256_castps128_ps256(a0), b0, 1);
+		y = _mm256_insertf128_ps(_mm256_castps128_ps256(a1), b1, 1);
+		z = _mm256_insertf128_ps(_mm256_castps128_ps256(a2), b2, 1);
+	}
+
+	static inline void storeXYZ(KernelPointT *p, F x, F y, F z){
+		//the transposes of loadXYZ backwards, with 1 in the pad
+		__m128 a0 = _mm256_castps256_ps128(x), a1 = _mm256_castps256_ps128(y);
+		__m128 a2 = _mm256_castps256_ps128(z), a3 = _mm_set1_ps(1.0f);
+		__m128 b0 = _mm256_extractf128_ps(x, 1), b1 = _mm256_extractf128_ps(y, 1);
+		__m128 b2 = _mm256_extractf128_ps(z, 1), b3 = _mm_set1_ps(1.0f);
+		_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+		_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+		_mm_store_ps(p[0].data, a0); _mm_store_ps(p[1].data, a1);
+		_mm_store_ps(p[2].data, a2); _mm_store_ps(p[3].data, a3);
+		_mm_store_ps(p[4].data, b0); _mm_store_ps(p[5].data, b1);
+		_mm_store_ps(p[6].data, b2); _mm_store_ps(p[7].data, b3);
+	}
+
+	static inline I loadRGBA(const KernelPointT *p){
+		//rgba is the 5th float of each 8-float point
+		const I index = _mm256_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56);
+		return _mm256_i32gather_epi32((const int *)&p[0].rgba, index, 4);
+	}
+
+	static inline unsigned int inside(F x, F y, F z, F lx, F ly, F lz, F hx, F hy, F hz){
+		F m = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, lx, _CMP_GE_OQ), _mm256_cmp_ps(x, hx, _CMP_LE_OQ)),
+		                    _mm256_and_ps(_mm256_cmp_ps(y, ly, _CMP_GE_OQ), _mm256_cmp_ps(y, hy, _CMP_LE_OQ)));
+		m = _mm256_and_ps(m, _mm256_and_ps(_mm256_cmp_ps(z, lz, _CMP_GE_OQ), _mm256_cmp_ps(z, hz, _CMP_LE_OQ)));
+		return (unsigned int)_mm256_movemask_ps(m);
+	}
+
+	static inline I zeroI(){ return _mm256_setzero_si256(); }
+	static inline I addI(I a, I b){ return _mm256_add_epi32(a, b); }
+
+	static inline void colourLanes(I rgba, I &r, I &g, I &b){
+		const I byte = _mm256_set1_epi32(0xff);
+		r = _mm256_and_si256(_mm256_srli_epi32(rgba, 16), byte);
+		g = _mm256_and_si256(_mm256_srli_epi32(rgba, 8), byte);
+		b = _mm256_and_si256(rgba, byte);
+	}
+
+	static inline void storeRGB(uint8_t *dst, I rgba){
+		//bytes of a packed colour are b, g, r, a; shuffled per 128-bit lane
+		const I order = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		                                 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		I packed = _mm256_shuffle_epi8(rgba, order);
+		uint8_t lanes[32];
+		_mm256_storeu_si256((I *)lanes, packed);
+		memcpy(dst, lanes, 12);
+		memcpy(dst + 12, lanes + 16, 12);
+	}
+
+	static inline float reduceMin(F a){
+		__m128 v = _mm_min_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+		v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_min_ss(v, _mm_shuffle_ps(v, v, 1));
+		return _mm_cvtss_f32(v);
+	}
+
+	static inline float reduceMax(F a){
+		__m128 v = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+		v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+		v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+		return _mm_cvtss_f32(v);
+	}
+
+	static inline uint64_t reduceAddI(I a){
+		uint32_t lanes[8];
+		_mm256_storeu_si256((I *)lanes, a);
+		uint64_t sum = 0;
+		for (int i = 0; i < 8; i++)
+			sum += lanes[i];
+		return sum;
+	}
+};
+
+}
+
+const PointKernels &avx2PointKernels(){
+	static const PointKernels kernels = makePointKernels<Avx2>("avx2");
+	return kernels;
+}
+
+}
@@ -0,0 +1,109 @@
+/*
+	AVX-512 point kernels (16 points per step), compiled with -mavx512f
+*/
+
+#include <immintrin.h>
+
+#include "point_kernels_impl.h"
+
+namespace bimur_robot_vision
+{
+
+namespace
+{
+
+struct Avx512
+{
+	typedef __m512 F;
+	typedef __m512i I;
+	enum { width = 16 };
+
+	//points are 8 floats apart
+	static inline __m512i stride(){
+		return _mm512_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120);
+	}
+
+	static inline F set1(float v){ return _mm512_set1_ps(v); }
+	static inline F min(F a, F b){ return _mm512_min_ps(a, b); }
+	static inline F max(F a, F b){ return _mm512_max_ps(a, b); }
+	static inline F abs(F a){
+		return _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(a), _mm512_set1_epi32(0x7fffffff)));
+	}
+	static inline F mul(F a, F b){ return _mm512_mul_ps(a, b); }
+	static inline F fmadd(F a, F b, F c){ return _mm512_fmadd_ps(a, b, c); }
+
+	static inline F loadF(const float *p){ return _mm512_loadu_ps(p); }
+	static inline void storeF(float *p, F v){ _mm512_storeu_ps(p, v); }
+	static inline F loadDepth(const uint16_t *p){
+		return _mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)p)));
+	}
+
+	static inline void loadXYZ(const KernelPointT *p, F &x, F &y, F &z){
+		const __m512i index = stride();
+		x = _mm512_i32gather_ps(index, &p[0].x, 4);
+		y = _mm512_i32gather_ps(index, &p[0].y, 4);
+		z = _mm512_i32gather_ps(index, &p[0].z, 4);
+	}
+
+	static inline void storeXYZ(KernelPointT *p, F x, F y, F z){
+		const __m512i index = stride();
+		_mm512_i32scatter_ps(&p[0].x, index, x, 4);
+		_mm512_i32scatter_ps(&p[0].y, index, y, 4);
+		_mm512_i32scatter_ps(&p[0].z, index, z, 4);
+		_mm512_i32scatter_ps(&p[0].data[3], index, _mm512_set1_ps(1.0f), 4);
+	}
+
+	static inline I loadRGBA(const KernelPointT *p){
+		return _mm512_i32gather_epi32(stride(), (const int *)&p[0].rgba, 4);
+	}
+
+	static inline unsigned int inside(F x, F y, F z, F lx, F ly, F lz, F hx, F hy, F hz){
+		__mmask16 m = _mm512_cmp_ps_mask(x, lx, _CMP_GE_OQ) & _mm512_cmp_ps_mask(x, hx, _CMP_LE_OQ);
+		m &= _mm512_cmp_ps_mask(y, ly, _CMP_GE_OQ) & _mm512_cmp_ps_mask(y, hy, _CMP_LE_OQ);
+		m &= _mm512_cmp_ps_mask(z, lz, _CMP_GE_OQ) & _mm512_cmp_ps_mask(z, hz, _CMP_LE_OQ);
+		return (unsigned int)m;
+	}
+
+	static inline I zeroI(){ return _mm512_setzero_si512(); }
+	static inline I addI(I a, I b){ return _mm512_add_epi32(a, b); }
+
+	static inline void colourLanes(I rgba, I &r, I &g, I &b){
+		const I byte = _mm512_set1_epi32(0xff);
+		r = _mm512_and_epi32(_mm512_srli_epi32(rgba, 16), byte);
+		g = _mm512_and_epi32(_mm512_srli_epi32(rgba, 8), byte);
+		b = _mm512_and_epi32(rgba, byte);
+	}
+
+	static inline void storeRGB(uint8_t *dst, I rgba){
+		//byte shuffles need AVX-512BW, so shuffle each 128-bit lane with SSSE3
+		const __m128i order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		uint8_t lane[16];
+		_mm_storeu_si128((__m128i *)lane, _mm_shuffle_epi8(_mm512_extracti32x4_epi32(rgba, 0), order));
+		memcpy(dst, lane, 12);
+		_mm_storeu_si128((__m128i *)lane, _mm_shuffle_epi8(_mm512_extracti32x4_epi32(rgba, 1), order));
+		memcpy(dst + 12, lane, 12);
+		_mm_storeu_si128((__m128i *)lane, _mm_shuffle_epi8(_mm512_extracti32x4_epi32(rgba, 2), order));
+		memcpy(dst + 24, lane, 12);
+		_mm_storeu_si128((__m128i *)lane, _mm_shuffle_epi8(_mm512_extracti32x4_epi32(rgba, 3), order));
+		memcpy(dst + 36, lane, 12);
+	}
+
+	static inline float reduceMin(F a){ return _mm512_reduce_min_ps(a); }
+	static inline float reduceMax(F a){ return _mm512_reduce_max_ps(a); }
+
+	static inline uint64_t reduceAddI(I a){
+		//widen first, 16 lanes of 32-bit sums could overflow
+		__m512i lo = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(a));
+		__m512i hi = _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(a, 1));
+		return (uint64_t)_mm512_reduce_add_epi64(_mm512_add_epi64(lo, hi));
+	}
+};
+
+}
+
+const PointKernels &avx512PointKernels(){
+	static const PointKernels kernels = makePointKernels<Avx512>("avx512");
+	return kernels;
+}
+
+}
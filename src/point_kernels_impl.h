@@ -0,0 +1,252 @@
+/*
+	Generic SIMD point kernels, instantiated once per instruction set by
+	point_kernels_<isa>.cpp with a traits type V providing:
+
+	  F, I, width                vector types and number of lanes
+	  set1, min, max, mul, abs, fmadd
+	  loadXYZ(p, x, y, z)        x, y, z of width points starting at p
+	  loadF(p), storeF(p, v)     width consecutive floats, unaligned
+	  loadDepth(p)               width consecutive uint16_t as floats
+	  loadRGBA(p)                packed colours of width points
+	  inside(x, y, z, lo, hi)    lane bitmask of lo <= xyz <= hi
+	  colourLanes(rgba, r, g, b) split colours into 32-bit lanes
+	  addI, zeroI
+	  storeRGB(dst, rgba)        3 bytes per point, exactly 3 * width bytes
+	  storeXYZ(p, x, y, z)       x, y, z, 1 of width points starting at p
+	  reduceMin, reduceMax       horizontal reductions
+	  reduceAddI                 horizontal sum of 32-bit lanes
+
+	Everything here has internal linkage, so code compiled with wider
+	instruction sets never leaks into other translation units. Leftover
+	points are handed to the scalar reference kernels, which include this
+	header for the helpers they share with the templates.
+*/
+
+#ifndef BIMUR_ROBOT_VISION_POINT_KERNELS_IMPL_H
+#define BIMUR_ROBOT_VISION_POINT_KERNELS_IMPL_H
+
+#include <math.h>
+#include <cfloat>
+#include <cstddef>
+#include <cstring>
+
+#include "bimur_robot_vision/point_kernels.h"
+
+namespace bimur_robot_vision
+{
+
+namespace
+{
+
+typedef pcl::PointXYZRGB KernelPointT;
+
+/*
+	Function: storeUnprojected()
+	Inputs  : KernelPointT&, float, float, float, const uint8_t*
+	Outputs : None
+	Purpose : fills in an unprojected point, shared by the unproject kernels
+*/
+inline void storeUnprojected(KernelPointT &p, float x, float y, float z, const uint8_t *rgb){
+	p.x = x;
+	p.y = y;
+	p.z = z;
+	p.data[3] = 1.0f;
+	p.rgba = rgb ? (0xffu << 24) | ((uint32_t)rgb[0] << 16) | ((uint32_t)rgb[1] << 8) | rgb[2] : (0xffu << 24);
+}
+
+template <typename V>
+void simdPlaneDistanceRange(const KernelPointT *points, size_t size, const float plane[4],
+                            float *min_distance, float *max_distance){
+	const float inv_norm = 1.0f / sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+	const typename V::F a = V::set1(plane[0] * inv_norm);
+	const typename V::F b = V::set1(plane[1] * inv_norm);
+	const typename V::F c = V::set1(plane[2] * inv_norm);
+	const typename V::F d = V::set1(plane[3] * inv_norm);
+
+	typename V::F lo = V::set1(FLT_MAX);
+	typename V::F hi = V::set1(-FLT_MAX);
+
+	size_t i = 0;
+	for (; i + V::width <= size; i += V::width){
+		typename V::F x, y, z;
+		V::loadXYZ(points + i, x, y, z);
+		typename V::F dist = V::abs(V::fmadd(a, x, V::fmadd(b, y, V::fmadd(c, z, d))));
+		lo = V::min(lo, dist);
+		hi = V::max(hi, dist);
+	}
+
+	float tail_min, tail_max;
+	scalarPointKernels().plane_distance_range(points + i, size - i, plane, &tail_min, &tail_max);
+	float vmin = V::reduceMin(lo);
+	float vmax = V::reduceMax(hi);
+	*min_distance = tail_min < vmin ? tail_min : vmin;
+	*max_distance = tail_max > vmax ? tail_max : vmax;
+}
+
+template <typename V>
+void simdBoundingBox(const KernelPointT *points, size_t size, float min[3], float max[3]){
+	typename V::F lx = V::set1(FLT_MAX), ly = lx, lz = lx;
+	typename V::F hx = V::set1(-FLT_MAX), hy = hx, hz = hx;
+
+	size_t i = 0;
+	for (; i + V::width <= size; i += V::width){
+		typename V::F x, y, z;
+		V::loadXYZ(points + i, x, y, z);
+		lx = V::min(lx, x); ly = V::min(ly, y); lz = V::min(lz, z);
+		hx = V::max(hx, x); hy = V::max(hy, y); hz = V::max(hz, z);
+	}
+
+	scalarPointKernels().bounding_box(points + i, size - i, min, max);
+	float vmin[3] = {V::reduceMin(lx), V::reduceMin(ly), V::reduceMin(lz)};
+	float vmax[3] = {V::reduceMax(hx), V::reduceMax(hy), V::reduceMax(hz)};
+	for (int k = 0; k < 3; k++){
+		min[k] = vmin[k] < min[k] ? vmin[k] : min[k];
+		max[k] = vmax[k] > max[k] ? vmax[k] : max[k];
+	}
+}
+
+template <typename V>
+void simdColourSums(const KernelPointT *points, size_t size, uint64_t sums[3]){
+	//32-bit lanes are flushed every block so they can not overflow
+	const size_t block = (size_t)1 << 22;
+
+	sums[0] = sums[1] = sums[2] = 0;
+
+	size_t i = 0;
+	while (i + V::width <= size){
+		size_t end = i + block < size ? i + block : size;
+		typename V::I sr = V::zeroI(), sg = V::zeroI(), sb = V::zeroI();
+		for (; i + V::width <= end; i += V::width){
+			typename V::I r, g, b;
+			V::colourLanes(V::loadRGBA(points + i), r, g, b);
+			sr = V::addI(sr, r);
+			sg = V::addI(sg, g);
+			sb = V::addI(sb, b);
+		}
+		sums[0] += V::reduceAddI(sr);
+		sums[1] += V::reduceAddI(sg);
+		sums[2] += V::reduceAddI(sb);
+	}
+
+	uint64_t tail[3];
+	scalarPointKernels().colour_sums(points + i, size - i, tail);
+	sums[0] += tail[0];
+	sums[1] += tail[1];
+	sums[2] += tail[2];
+}
+
+template <typename V>
+size_t simdCrop(const KernelPointT *points, size_t size, const float lo[3], const float hi[3], KernelPointT *out){
+	const typename V::F lx = V::set1(lo[0]), ly = V::set1(lo[1]), lz = V::set1(lo[2]);
+	const typename V::F hx = V::set1(hi[0]), hy = V::set1(hi[1]), hz = V::set1(hi[2]);
+
+	size_t n = 0;
+	size_t i = 0;
+	for (; i + V::width <= size; i += V::width){
+		typename V::F x, y, z;
+		V::loadXYZ(points + i, x, y, z);
+		unsigned int mask = V::inside(x, y, z, lx, ly, lz, hx, hy, hz);
+
+		if (mask == (1u << V::width) - 1){
+			if (out + n != points + i)
+				memmove(out + n, points + i, V::width * sizeof(KernelPointT));
+			n += V::width;
+			continue;
+		}
+		while (mask){
+			unsigned int lane = __builtin_ctz(mask);
+			mask &= mask - 1;
+			if (out + n != points + i + lane)
+				out[n] = points[i + lane];
+			n++;
+		}
+	}
+
+	return n + scalarPointKernels().crop(points + i, size - i, lo, hi, out + n);
+}
+
+template <typename V>
+void simdUnpackRgb(const KernelPointT *points, size_t size, uint8_t *rgb){
+	size_t i = 0;
+	for (; i + V::width <= size; i += V::width)
+		V::storeRGB(rgb + 3 * i, V::loadRGBA(points + i));
+
+	scalarPointKernels().unpack_rgb(points + i, size - i, rgb + 3 * i);
+}
+
+template <typename V>
+void simdTransform(const KernelPointT *points, size_t size, const float m[12], KernelPointT *out){
+	const typename V::F r00 = V::set1(m[0]), r01 = V::set1(m[1]), r02 = V::set1(m[2]), t0 = V::set1(m[3]);
+	const typename V::F r10 = V::set1(m[4]), r11 = V::set1(m[5]), r12 = V::set1(m[6]), t1 = V::set1(m[7]);
+	const typename V::F r20 = V::set1(m[8]), r21 = V::set1(m[9]), r22 = V::set1(m[10]), t2 = V::set1(m[11]);
+
+	size_t i = 0;
+	for (; i + V::width <= size; i += V::width){
+		typename V::F x, y, z;
+		V::loadXYZ(points + i, x, y, z);
+		typename V::F tx = V::fmadd(r00, x, V::fmadd(r01, y, V::fmadd(r02, z, t0)));
+		typename V::F ty = V::fmadd(r10, x, V::fmadd(r11, y, V::fmadd(r12, z, t1)));
+		typename V::F tz = V::fmadd(r20, x, V::fmadd(r21, y, V::fmadd(r22, z, t2)));
+
+		//the colour half of each point is copied as is
+		if (out != points){
+			for (size_t k = i; k < i + V::width; k++)
+				memcpy(&out[k].rgba, &points[k].rgba, sizeof(KernelPointT) - offsetof(KernelPointT, rgba));
+		}
+		V::storeXYZ(out + i, tx, ty, tz);
+	}
+
+	scalarPointKernels().transform(points + i, size - i, m, out + i);
+}
+
+template <typename V>
+size_t simdUnproject(const uint16_t *depth, const float *ray_x, const float *ray_y, size_t size, float scale,
+                     const uint8_t *rgb, const float lo[3], const float hi[3], KernelPointT *out){
+	const typename V::F s = V::set1(scale);
+	const typename V::F lx = V::set1(lo[0]), ly = V::set1(lo[1]), lz = V::set1(lo[2] > FLT_MIN ? lo[2] : FLT_MIN);
+	const typename V::F hx = V::set1(hi[0]), hy = V::set1(hi[1]), hz = V::set1(hi[2]);
+
+	size_t n = 0;
+	size_t i = 0;
+	for (; i + V::width <= size; i += V::width){
+		typename V::F z = V::mul(V::loadDepth(depth + i), s);
+		typename V::F x = V::mul(z, V::loadF(ray_x + i));
+		typename V::F y = V::mul(z, V::loadF(ray_y + i));
+		unsigned int mask = V::inside(x, y, z, lx, ly, lz, hx, hy, hz);
+		if (!mask)
+			continue;
+
+		float xs[V::width], ys[V::width], zs[V::width];
+		V::storeF(xs, x);
+		V::storeF(ys, y);
+		V::storeF(zs, z);
+		while (mask){
+			unsigned int lane = __builtin_ctz(mask);
+			mask &= mask - 1;
+			storeUnprojected(out[n++], xs[lane], ys[lane], zs[lane], rgb ? rgb + 3 * (i + lane) : NULL);
+		}
+	}
+
+	return n + scalarPointKernels().unproject(depth + i, ray_x + i, ray_y + i, size - i, scale,
+	                                          rgb ? rgb + 3 * i : NULL, lo, hi, out + n);
+}
+
+template <typename V>
+PointKernels makePointKernels(const char *name){
+	PointKernels k;
+	k.name = name;
+	k.plane_distance_range = &simdPlaneDistanceRange<V>;
+	k.bounding_box = &simdBoundingBox<V>;
+	k.colour_sums = &simdColourSums<V>;
+	k.crop = &simdCrop<V>;
+	k.unpack_rgb = &simdUnpackRgb<V>;
+	k.transform = &simdTransform<V>;
+	k.unproject = &simdUnproject<V>;
+	return k;
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+	SSE4.2 point kernels (4 points per step), compiled with -msse4.2
+*/
+
+#include <nmmintrin.h>
+
+#include "point_kernels_impl.h"
+
+namespace bimur_robot_vision
+{
+
+namespace
+{
+
+struct Sse42
+{
+	typedef __m128 F;
+	typedef __m128i I;
+	enum { width = 4 };
+
+	static inline F set1(float v){ return _mm_set1_ps(v); }
+	static inline F min(F a, F b){ return _mm_min_ps(a, b); }
+	static inline F max(F a, F b){ return _mm_max_ps(a, b); }
+	static inline F abs(F a){ return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	static inline F mul(F a, F b){ return _mm_mul_ps(a, b); }
+	static inline F fmadd(F a, F b, F c){ return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+	static inline F loadF(const float *p){ return _mm_loadu_ps(p); }
+	static inline void storeF(float *p, F v){ _mm_storeu_ps(p, v); }
+	static inline F loadDepth(const uint16_t *p){
+		return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)p)));
+	}
+
+	static inline void loadXYZ(const KernelPointT *p, F &x, F &y, F &z){
+		F r0 = _mm_load_ps(p[0].data);
+		F r1 = _mm_load_ps(p[1].data);
+		F r2 = _mm_load_ps(p[2].data);
+		F r3 = _mm_load_ps(p[3].data);
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+		x = r0; y = r1; z = r2;
+	}
+
+	static inline void storeXYZ(KernelPointT *p, F x, F y, F z){
+		F w = _mm_set1_ps(1.0f);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_store_ps(p[0].data, x);
+		_mm_store_ps(p[1].data, y);
+		_mm_store_ps(p[2].data, z);
+		_mm_store_ps(p[3].data, w);
+	}
+
+	static inline I loadRGBA(const KernelPointT *p){
+		return _mm_setr_epi32(p[0].rgba, p[1].rgba, p[2].rgba, p[3].rgba);
+	}
+
+	static inline unsigned int inside(F x, F y, F z, F lx, F ly, F lz, F hx, F hy, F hz){
+		F m = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, lx), _mm_cmple_ps(x, hx)),
+		                 _mm_and_ps(_mm_cmpge_ps(y, ly), _mm_cmple_ps(y, hy)));
+		m = _mm_and_ps(m, _mm_and_ps(_mm_cmpge_ps(z, lz), _mm_cmple_ps(z, hz)));
+		return (unsigned int)_mm_movemask_ps(m);
+	}
+
+	static inline I zeroI(){ return _mm_setzero_si128(); }
+	static inline I addI(I a, I b){ return _mm_add_epi32(a, b); }
+
+	static inline void colourLanes(I rgba, I &r, I &g, I &b){
+		const I byte = _mm_set1_epi32(0xff);
+		r = _mm_and_si128(_mm_srli_epi32(rgba, 16), byte);
+		g = _mm_and_si128(_mm_srli_epi32(rgba, 8), byte);
+		b = _mm_and_si128(rgba, byte);
+	}
+
+	static inline void storeRGB(uint8_t *dst, I rgba){
+		//bytes of a packed colour are b, g, r, a
+		const I order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+		I packed = _mm_shuffle_epi8(rgba, order);
+		_mm_storel_epi64((I *)dst, packed);
+		int last = _mm_extract_epi32(packed, 2);
+		memcpy(dst + 8, &last, 4);
+	}
+
+	static inline float reduceMin(F a){
+		a = _mm_min_ps(a, _mm_movehl_ps(a, a));
+		a = _mm_min_ss(a, _mm_shuffle_ps(a, a, 1));
+		return _mm_cvtss_f32(a);
+	}
+
+	static inline float reduceMax(F a){
+		a = _mm_max_ps(a, _mm_movehl_ps(a, a));
+		a = _mm_max_ss(a, _mm_shuffle_ps(a, a, 1));
+		return _mm_cvtss_f32(a);
+	}
+
+	static inline uint64_t reduceAddI(I a){
+		uint32_t lanes[4];
+		_mm_storeu_si128((I *)lanes, a);
+		return (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+};
+
+}
+
+const PointKernels &sse42PointKernels(){
+	static const PointKernels kernels = makePointKernels<Sse42>("sse42");
+	return kernels;
+}
+
+}
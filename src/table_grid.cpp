@@ -0,0 +1,206 @@
+/*
+	Occupancy grid of the table top, see table_grid.h
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <Eigen/Geometry>
+
+#include "bimur_robot_vision/table_grid.h"
+
+namespace bimur_robot_vision
+{
+
+const int8_t TableGrid::UNKNOWN;
+const int8_t TableGrid::FREE;
+const int8_t TableGrid::OCCUPIED;
+
+TableGrid::TableGrid()
+{
+	clear();
+}
+
+void TableGrid::clear(){
+	resolution_ = 0.0f;
+	width_ = 0;
+	height_ = 0;
+	origin_.setZero();
+	axes_.setIdentity();
+	offset_ = 0.0f;
+	cells_.clear();
+}
+
+void TableGrid::build(const PointCloudT &cloud, const std::vector<int> &indices, const Eigen::Vector4f &plane,
+                      float resolution){
+	clear();
+	if (indices.empty() || resolution <= 0.0f)
+		return;
+
+	//unit normal pointing at the origin of the cloud
+	Eigen::Vector3f n = plane.head<3>();
+	float norm = n.norm();
+	n /= norm;
+	float d = plane(3) / norm;
+	if (d < 0.0f){
+		n = -n;
+		d = -d;
+	}
+
+	//first axis along the x axis of the cloud, or y if the table faces sideways
+	Eigen::Vector3f u = Eigen::Vector3f::UnitX() - n * n.x();
+	if (u.norm() < 1e-3f)
+		u = Eigen::Vector3f::UnitY() - n * n.y();
+	u.normalize();
+	Eigen::Vector3f v = n.cross(u);
+
+	//extent of the table along the axes, from the point of the plane nearest to the origin
+	Eigen::Vector3f centre = -d * n;
+	float lo[2] = {FLT_MAX, FLT_MAX};
+	float hi[2] = {-FLT_MAX, -FLT_MAX};
+	for (size_t i = 0; i < indices.size(); i++){
+		const PointT &p = cloud.points[indices[i]];
+		Eigen::Vector3f q = p.getVector3fMap() - centre;
+		float a = u.dot(q), b = v.dot(q);
+		lo[0] = std::min(lo[0], a); hi[0] = std::max(hi[0], a);
+		lo[1] = std::min(lo[1], b); hi[1] = std::max(hi[1], b);
+	}
+
+	resolution_ = resolution;
+	width_ = (int)std::floor((hi[0] - lo[0]) / resolution) + 1;
+	height_ = (int)std::floor((hi[1] - lo[1]) / resolution) + 1;
+	origin_ = centre + u * lo[0] + v * lo[1];
+	axes_.col(0) = u;
+	axes_.col(1) = v;
+	axes_.col(2) = n;
+	offset_ = d;
+
+	cells_.assign((size_t)width_ * height_, UNKNOWN);
+	for (size_t i = 0; i < indices.size(); i++){
+		Eigen::Vector3f q = cloud.points[indices[i]].getVector3fMap() - origin_;
+		int x = std::min((int)(u.dot(q) / resolution), width_ - 1);
+		int y = std::min((int)(v.dot(q) / resolution), height_ - 1);
+		cells_[(size_t)y * width_ + x] = FREE;
+	}
+}
+
+void TableGrid::addObstacles(const PointT *points, size_t size, float min_height){
+	if (cells_.empty())
+		return;
+
+	const Eigen::Vector3f u = axes_.col(0), v = axes_.col(1), n = axes_.col(2);
+	const float inverse_resolution = 1.0f / resolution_;
+	for (size_t i = 0; i < size; i++){
+		Eigen::Vector3f p = points[i].getVector3fMap();
+		if (!p.allFinite() || n.dot(p) + offset_ < min_height)
+			continue;
+		Eigen::Vector3f q = p - origin_;
+		float a = u.dot(q) * inverse_resolution, b = v.dot(q) * inverse_resolution;
+		if (a < 0.0f || b < 0.0f || a >= width_ || b >= height_)
+			continue;
+		cells_[(size_t)b * width_ + (size_t)a] = OCCUPIED;
+	}
+}
+
+Eigen::Vector3f TableGrid::cellCentre(int x, int y) const {
+	return origin_ + axes_.col(0) * ((x + 0.5f) * resolution_) + axes_.col(1) * ((y + 0.5f) * resolution_);
+}
+
+/*
+	Function: distanceTransform1D()
+	Inputs  : const float*, int, float*, int*, float*
+	Outputs : None
+	Purpose : squared euclidean distance transform of a sampled function
+	          (Felzenszwalb and Huttenlocher), v and z are scratch of n and n + 1
+*/
+static void distanceTransform1D(const float *f, int n, float *d, int *v, float *z){
+	int k = 0;
+	v[0] = 0;
+	z[0] = -FLT_MAX;
+	z[1] = FLT_MAX;
+	for (int q = 1; q < n; q++){
+		float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		while (s <= z[k]){
+			k--;
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2 * q - 2 * v[k]);
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = FLT_MAX;
+	}
+
+	k = 0;
+	for (int q = 0; q < n; q++){
+		while (z[k + 1] < q)
+			k++;
+		d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+void TableGrid::findPlacements(float radius, int max_placements, std::vector<Placement> &out) const {
+	out.clear();
+	if (cells_.empty() || max_placements <= 0)
+		return;
+
+	//squared distance in cells to the nearest cell that is not free; the
+	//border of unknown cells around the grid keeps discs on the table
+	const int w = width_ + 2, h = height_ + 2;
+	const float inf = (float)(w * w + h * h);
+	std::vector<float> dist((size_t)w * h, 0.0f);
+	for (int y = 0; y < height_; y++){
+		for (int x = 0; x < width_; x++){
+			if (cells_[(size_t)y * width_ + x] == FREE)
+				dist[(size_t)(y + 1) * w + x + 1] = inf;
+		}
+	}
+
+	const int n = std::max(w, h);
+	std::vector<float> f(n), d(n), z(n + 1);
+	std::vector<int> v(n);
+	for (int x = 0; x < w; x++){
+		for (int y = 0; y < h; y++)
+			f[y] = dist[(size_t)y * w + x];
+		distanceTransform1D(&f[0], h, &d[0], &v[0], &z[0]);
+		for (int y = 0; y < h; y++)
+			dist[(size_t)y * w + x] = d[y];
+	}
+	for (int y = 0; y < h; y++){
+		distanceTransform1D(&dist[(size_t)y * w], w, &d[0], &v[0], &z[0]);
+		std::copy(d.begin(), d.begin() + w, dist.begin() + (size_t)y * w);
+	}
+
+	//every cell whose free disc is wide enough, widest first
+	std::vector<std::pair<float, int> > candidates;
+	for (int y = 0; y < height_; y++){
+		for (int x = 0; x < width_; x++){
+			//the obstacle's cell starts half a cell before its centre
+			float clearance = (std::sqrt(dist[(size_t)(y + 1) * w + x + 1]) - 0.5f) * resolution_;
+			if (clearance >= radius)
+				candidates.push_back(std::make_pair(-clearance, y * width_ + x));
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	const float separation_sq = 4.0f * radius * radius;
+	for (size_t i = 0; i < candidates.size() && (int)out.size() < max_placements; i++){
+		int x = candidates[i].second % width_;
+		int y = candidates[i].second / width_;
+		Eigen::Vector2f position((x + 0.5f) * resolution_, (y + 0.5f) * resolution_);
+
+		bool overlaps = false;
+		for (size_t j = 0; j < out.size() && !overlaps; j++)
+			overlaps = (out[j].position - position).squaredNorm() < separation_sq;
+		if (overlaps)
+			continue;
+
+		Placement placement;
+		placement.position = position;
+		placement.point = cellCentre(x, y);
+		placement.clearance = -candidates[i].first;
+		out.push_back(placement);
+	}
+}
+
+}
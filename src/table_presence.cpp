@@ -0,0 +1,104 @@
+/*
+	Quick check of what stands on a known table, see table_presence.h
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "bimur_robot_vision/table_presence.h"
+
+namespace bimur_robot_vision
+{
+
+PresenceParams::PresenceParams()
+	: min_height(0.02f),
+	  max_height(0.5f),
+	  histogram_bin(0.01f),
+	  cell_size(0.02f),
+	  min_cell_points(5),
+	  min_object_points(50)
+{
+}
+
+TablePresence::TablePresence(const PresenceParams &params)
+	: params_(params)
+{
+}
+
+void TablePresence::count(const PointT *points, size_t size, const TableGrid &table, PresenceResult &result){
+	result.num_points_above = 0;
+	result.height_histogram.assign((size_t)std::ceil((params_.max_height - params_.min_height) / params_.histogram_bin), 0);
+	result.object_points.clear();
+	if (table.empty())
+		return;
+
+	//coarse cells are whole groups of table cells
+	const int factor = std::max(1, (int)(params_.cell_size / table.resolution() + 0.5f));
+	const int width = (table.width() + factor - 1) / factor;
+	const int height = (table.height() + factor - 1) / factor;
+	cell_points_.assign((size_t)width * height, 0);
+
+	const Eigen::Vector3f u = table.axes().col(0), v = table.axes().col(1);
+	const float inverse_resolution = 1.0f / table.resolution();
+	const float inverse_bin = 1.0f / params_.histogram_bin;
+	const std::vector<int8_t> &cells = table.cells();
+	const int bins = (int)result.height_histogram.size();
+
+	//**one pass: height histogram and coarse cell counts**//
+	for (size_t i = 0; i < size; i++){
+		Eigen::Vector3f p(points[i].x, points[i].y, points[i].z);
+		float h = table.heightOf(p);
+		//written so that NaN fails
+		if (!(h >= params_.min_height && h <= params_.max_height))
+			continue;
+
+		Eigen::Vector3f q = p - table.origin();
+		float a = u.dot(q) * inverse_resolution, b = v.dot(q) * inverse_resolution;
+		if (!(a >= 0.0f && b >= 0.0f && a < table.width() && b < table.height()))
+			continue;
+		int x = (int)a, y = (int)b;
+		if (cells[(size_t)y * table.width() + x] == TableGrid::UNKNOWN)
+			continue;
+
+		result.num_points_above++;
+		result.height_histogram[std::min((int)((h - params_.min_height) * inverse_bin), bins - 1)]++;
+		cell_points_[(size_t)(y / factor) * width + x / factor]++;
+	}
+
+	//**8-connected groups of occupied coarse cells**//
+	labels_.assign(cell_points_.size(), 0);
+	for (size_t start = 0; start < cell_points_.size(); start++){
+		if (labels_[start] || cell_points_[start] < params_.min_cell_points)
+			continue;
+
+		int total = 0;
+		labels_[start] = 1;
+		stack_.assign(1, (int)start);
+		while (!stack_.empty()){
+			int c = stack_.back();
+			stack_.pop_back();
+			total += cell_points_[c];
+
+			int cx = c % width, cy = c / width;
+			for (int dy = -1; dy <= 1; dy++){
+				for (int dx = -1; dx <= 1; dx++){
+					int nx = cx + dx, ny = cy + dy;
+					if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+						continue;
+					int n = ny * width + nx;
+					if (labels_[n] || cell_points_[n] < params_.min_cell_points)
+						continue;
+					labels_[n] = 1;
+					stack_.push_back(n);
+				}
+			}
+		}
+
+		if (total >= params_.min_object_points)
+			result.object_points.push_back(total);
+	}
+	std::sort(result.object_points.begin(), result.object_points.end(), std::greater<int>());
+}
+
+}
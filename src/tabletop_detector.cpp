@@ -0,0 +1,441 @@
+/*
+	In-process tabletop detection, see tabletop_detector.h
+*/
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <pcl/ModelCoefficients.h>
+#include <pcl/PointIndices.h>
+#include <pcl/filters/crop_box.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/filters/extract_indices.h>
+#include <pcl/sample_consensus/method_types.h>
+#include <pcl/sample_consensus/model_types.h>
+#include <pcl/segmentation/sac_segmentation.h>
+#include <pcl/segmentation/extract_clusters.h>
+#include <pcl/search/kdtree.h>
+
+#include "bimur_robot_vision/tabletop_detector.h"
+#include "bimur_robot_vision/point_kernels.h"
+
+namespace bimur_robot_vision
+{
+
+DetectorParams::DetectorParams()
+	: z_min(0.0f),
+	  z_max(1.0f),
+	  x_min(-FLT_MAX),
+	  x_max(FLT_MAX),
+	  y_min(-FLT_MAX),
+	  y_max(FLT_MAX),
+	  leaf_size(0.005f),
+	  plane_max_iterations(1000),
+	  plane_distance_threshold(0.02f),
+	  cluster_tolerance(0.04f),
+	  min_cluster_size(50),
+	  max_cluster_size(25000),
+	  incremental_clustering(true),
+	  plane_distance_tolerance(0.09)
+{
+}
+
+DetectOptions::DetectOptions()
+	: full_resolution(false),
+	  max_objects(0),
+	  rank_by(RANK_BY_SIZE),
+	  reference_point(Eigen::Vector3f::Zero()),
+	  table_grid_resolution(0.0f),
+	  levels_of_detail(false)
+{
+}
+
+void TabletopResult::clear(){
+	is_plane_found = false;
+	plane_coefficients.setZero();
+	plane_model.setZero();
+	plane.clear();
+	blobs.clear();
+	cluster_points.clear();
+	clusters.clear();
+	table_grid.clear();
+	num_filtered = 0;
+	num_candidates = 0;
+}
+
+size_t ClusterView::lodPrefix(int level, int max_points) const {
+	level = std::min(std::max(level, 0), LOD_LEVELS - 1);
+	if (max_points <= 0)
+		return lod_size[level];
+
+	//finest level that fits, or a cut through the coarsest one
+	for (int l = level; l < LOD_LEVELS; l++){
+		if (lod_size[l] <= (size_t)max_points)
+			return lod_size[l];
+	}
+	return (size_t)max_points;
+}
+
+void planeDistanceRange(const pcl::PointXYZRGB *points, size_t size, const Eigen::Vector4f &plane,
+                        double &min_distance, double &max_distance){
+	if (size == 0){
+		min_distance = 1000.0;
+		max_distance = -1000.0;
+		return;
+	}
+
+	float lo, hi;
+	pointKernels().plane_distance_range(points, size, plane.data(), &lo, &hi);
+	min_distance = lo;
+	max_distance = hi;
+}
+
+
+TabletopDetector::TabletopDetector(const DetectorParams &params)
+	: params_(params),
+	  clustering_(params.leaf_size, params.cluster_tolerance),
+	  raw_map_(params.leaf_size),
+	  cloud_(new PointCloudT),
+	  cloud_filtered_(new PointCloudT)
+{
+}
+
+void TabletopDetector::setParams(const DetectorParams &params){
+	bool reset = params.leaf_size != params_.leaf_size;
+	params_ = params;
+	if (reset){
+		clustering_ = IncrementalVoxelClustering(params_.leaf_size, params_.cluster_tolerance);
+		raw_map_ = VoxelRawMap(params_.leaf_size);
+	} else {
+		clustering_.setTolerance(params_.cluster_tolerance);
+	}
+}
+
+bool TabletopDetector::worseCandidate(const Candidate &a, const Candidate &b){
+	return a.score < b.score;
+}
+
+/*
+	Function: computeClusters()
+	Inputs  : const PointCloudT&
+	Outputs : None
+	Purpose : euclidean clustering into candidates_, largest cluster first
+*/
+void TabletopDetector::computeClusters(const PointCloudT &in){
+	candidates_.clear();
+
+	if (params_.incremental_clustering){
+		//only the voxels that changed since the last frame are re-clustered
+		clustering_.setTolerance(params_.cluster_tolerance);
+		clustering_.update(in);
+
+		std::vector<VoxelCluster> voxel_clusters;
+		clustering_.clusters(params_.min_cluster_size, params_.max_cluster_size, voxel_clusters);
+		candidates_.resize(voxel_clusters.size());
+		for (size_t i = 0; i < voxel_clusters.size(); i++){
+			candidates_[i].aggregate = voxel_clusters[i].aggregate;
+			candidates_[i].id = voxel_clusters[i].id;
+			candidates_[i].points.reset();
+			candidates_[i].score = 0;
+		}
+		return;
+	}
+
+	//the input is only borrowed for the duration of the call
+	PointCloudT::ConstPtr input (&in, [](const PointCloudT *){});
+
+	pcl::search::KdTree<PointT>::Ptr tree (new pcl::search::KdTree<PointT>);
+	tree->setInputCloud (input);
+
+	std::vector<pcl::PointIndices> cluster_indices;
+	pcl::EuclideanClusterExtraction<PointT> ec;
+	ec.setClusterTolerance (params_.cluster_tolerance);
+	ec.setMinClusterSize (params_.min_cluster_size);
+	ec.setMaxClusterSize (params_.max_cluster_size);
+	ec.setSearchMethod (tree);
+	ec.setInputCloud (input);
+	ec.extract (cluster_indices);
+
+	const float inverse_leaf = 1.0f / params_.leaf_size;
+	candidates_.resize(cluster_indices.size());
+	for (size_t i = 0; i < cluster_indices.size(); i++){
+		Candidate &c = candidates_[i];
+		c.aggregate = ClusterAggregate();
+		c.id = -1;
+		c.score = 0;
+		c.points.reset (new PointCloudT);
+
+		const std::vector<int> &indices = cluster_indices[i].indices;
+		c.points->points.reserve(indices.size());
+		for (size_t j = 0; j < indices.size(); j++){
+			const PointT &p = in.points[indices[j]];
+			c.points->points.push_back (p);
+			c.aggregate.add (p);
+			c.aggregate.expand (Eigen::Vector3i(voxelCoord(p.x, inverse_leaf),
+			                                    voxelCoord(p.y, inverse_leaf),
+			                                    voxelCoord(p.z, inverse_leaf)));
+		}
+		c.points->width = c.points->points.size ();
+		c.points->height = 1;
+		c.points->is_dense = true;
+	}
+}
+
+/*
+	Function: gatherCandidate()
+	Inputs  : Candidate&
+	Outputs : const PointCloudT&
+	Purpose : points of a cluster; incremental clusters are gathered into a
+	          scratch buffer on demand
+*/
+const TabletopDetector::PointCloudT &TabletopDetector::gatherCandidate(Candidate &c){
+	if (c.points)
+		return *c.points;
+	gathered_.clear();
+	clustering_.gather(c.id, gathered_);
+	return gathered_;
+}
+
+/*
+	Function: rankCandidate()
+	Inputs  : const Candidate&, const DetectOptions&, const Eigen::Vector4f&
+	Outputs : double
+	Purpose : ranking score of a cluster from its aggregates alone, higher is better
+*/
+double TabletopDetector::rankCandidate(const Candidate &c, const DetectOptions &options,
+                                       const Eigen::Vector4f &plane) const {
+	const ClusterAggregate &agg = c.aggregate;
+
+	if (options.rank_by == RANK_BY_DISTANCE){
+		//nearest to the reference point first
+		return -(agg.centroid() - options.reference_point).norm();
+	}
+
+	if (options.rank_by == RANK_BY_HEIGHT){
+		//highest voxel bound corner above the plane
+		Eigen::Vector3f lo = agg.min_voxel.cast<float>() * params_.leaf_size;
+		Eigen::Vector3f hi = (agg.max_voxel.cast<float>() + Eigen::Vector3f::Ones()) * params_.leaf_size;
+		Eigen::Vector3f n = plane.head<3>();
+		float norm = n.norm();
+		double height = -1000.0;
+		for (int corner = 0; corner < 8; corner++){
+			Eigen::Vector3f p((corner & 1) ? hi.x() : lo.x(),
+			                  (corner & 2) ? hi.y() : lo.y(),
+			                  (corner & 4) ? hi.z() : lo.z());
+			height = std::max(height, (double)std::fabs(n.dot(p) + plane(3)) / norm);
+		}
+		return height;
+	}
+
+	//largest first
+	return agg.count;
+}
+
+/*
+	Function: orderLevelsOfDetail()
+	Inputs  : PointT*, size_t, size_t*
+	Outputs : None
+	Purpose : reorders the points of a cluster coarse to fine and counts the
+	          points of each level of detail into lod_size
+*/
+void TabletopDetector::orderLevelsOfDetail(PointT *points, size_t size, size_t *lod_size){
+	lod_level_.assign(size, 0);
+
+	//the cells of a level nest in the cells of the next coarser one, so the
+	//points kept at a coarse level are also kept at every finer level
+	for (int l = LOD_LEVELS - 1; l >= 1; l--){
+		const float inverse_cell = 1.0f / (params_.leaf_size * (1 << l));
+		lod_cells_.clear();
+		for (size_t i = 0; i < size; i++){
+			if (lod_level_[i] <= l)
+				continue;
+			const PointT &p = points[i];
+			lod_cells_[packVoxelKey(voxelCoord(p.x, inverse_cell), voxelCoord(p.y, inverse_cell),
+			                        voxelCoord(p.z, inverse_cell))] = (int)i;
+		}
+		for (size_t i = 0; i < size; i++){
+			if (lod_level_[i] > l)
+				continue;
+			const PointT &p = points[i];
+			VoxelKey key = packVoxelKey(voxelCoord(p.x, inverse_cell), voxelCoord(p.y, inverse_cell),
+			                            voxelCoord(p.z, inverse_cell));
+			if (lod_cells_.insert(std::make_pair(key, (int)i)).second)
+				lod_level_[i] = l;
+		}
+	}
+
+	//counting sort by level, coarsest first and stable within a level
+	size_t start[LOD_LEVELS + 1] = {0};
+	for (size_t i = 0; i < size; i++)
+		start[LOD_LEVELS - lod_level_[i]]++;
+	for (int l = 0; l < LOD_LEVELS; l++)
+		start[l + 1] += start[l];
+
+	lod_order_.resize(size);
+	for (size_t i = 0; i < size; i++)
+		lod_order_[start[LOD_LEVELS - 1 - lod_level_[i]]++] = i;
+
+	lod_points_.assign(points, points + size);
+	for (size_t i = 0; i < size; i++)
+		points[i] = lod_points_[lod_order_[i]];
+
+	//after the sort start[k] is the end of the k + 1 coarsest levels
+	for (int l = 0; l < LOD_LEVELS; l++)
+		lod_size[l] = start[LOD_LEVELS - 1 - l];
+}
+
+bool TabletopDetector::detect(const PointCloudT &frame, const DetectOptions &options, TabletopResult &result){
+	FrameView view(frame.points.empty() ? NULL : &frame.points[0], frame.points.size());
+	view.header = frame.header;
+	return detect(view, options, result);
+}
+
+bool TabletopDetector::detect(const FrameView &frame, const DetectOptions &options, TabletopResult &result){
+	result.clear();
+
+	//**Step 1: z-filter and voxel filter**//
+
+	//the z and ROI filter doubles as the copy of the frame into the pipeline
+	const PointKernels &kernels = pointKernels();
+	const float lo[3] = {params_.x_min, params_.y_min, params_.z_min};
+	const float hi[3] = {params_.x_max, params_.y_max, params_.z_max};
+
+	cloud_->header = frame.header;
+	std::vector<PointT, Eigen::aligned_allocator<PointT> > &points = cloud_->points;
+	points.resize(frame.size);
+	if (frame.size > 0)
+		points.resize(kernels.crop(frame.points, frame.size, lo, hi, &points[0]));
+	cloud_->width = points.size();
+	cloud_->height = 1;
+	cloud_->is_dense = true;
+
+	if (points.empty())
+		return false;
+
+	pcl::VoxelGrid<PointT> vg;
+	vg.setInputCloud (cloud_);
+	vg.setLeafSize (params_.leaf_size, params_.leaf_size, params_.leaf_size);
+	vg.filter (*cloud_filtered_);
+	result.num_filtered = cloud_filtered_->points.size();
+
+	//remember which raw points went into each voxel, only if they will be asked for
+	if (options.full_resolution)
+		raw_map_.build(cloud_);
+	else
+		raw_map_.clear();
+
+	//**Step 2: plane fitting**//
+
+	pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients ());
+	pcl::PointIndices::Ptr inliers (new pcl::PointIndices ());
+	pcl::SACSegmentation<PointT> seg;
+	seg.setOptimizeCoefficients (true);
+	seg.setModelType (pcl::SACMODEL_PLANE);
+	seg.setMethodType (pcl::SAC_RANSAC);
+	seg.setMaxIterations (params_.plane_max_iterations);
+	seg.setDistanceThreshold (params_.plane_distance_threshold);
+	seg.setInputCloud (cloud_filtered_);
+	seg.segment (*inliers, *coefficients);
+
+	if (inliers->indices.empty() || coefficients->values.size() < 4)
+		return true;
+
+	//everything else goes to cluster extraction
+	pcl::ExtractIndices<PointT> extract;
+	extract.setInputCloud (cloud_filtered_);
+	extract.setIndices (inliers);
+	extract.setNegative (true);
+	extract.filter (result.blobs);
+
+	result.is_plane_found = true;
+	result.plane_model = Eigen::Vector4f(coefficients->values[0], coefficients->values[1],
+	                                     coefficients->values[2], coefficients->values[3]);
+	result.plane_coefficients = result.plane_model + Eigen::Vector4f(0.1f, 0.5f, 0.1f, 0.0f);
+
+	//table footprint: inliers are free, anything above the inlier band is occupied
+	if (options.table_grid_resolution > 0.0f){
+		result.table_grid.build(*cloud_filtered_, inliers->indices, result.plane_model, options.table_grid_resolution);
+		if (!result.blobs.points.empty())
+			result.table_grid.addObstacles(&result.blobs.points[0], result.blobs.points.size(),
+			                               params_.plane_distance_threshold);
+	}
+
+	//**Step 3: Eucledian Cluster Extraction**//
+	computeClusters(result.blobs);
+	result.num_candidates = candidates_.size();
+
+	//creates a box contraint and filters out noise outside of specified box based on the found plane for max values
+	pcl::CropBox<PointT> boxFilter;
+	boxFilter.setMin(Eigen::Vector4f(0, 0, 0, 1.0));
+	boxFilter.setMax(result.plane_coefficients);
+	boxFilter.setInputCloud(cloud_filtered_);
+	boxFilter.filter(result.plane);
+	result.plane.header = cloud_->header;
+
+	//top-k mode: rank the clusters from their aggregates and only look at as
+	//many as it takes to accept max_objects of them
+	bool top_k = options.max_objects > 0 && options.max_objects < (int)candidates_.size();
+	if (top_k){
+		for (size_t i = 0; i < candidates_.size(); i++)
+			candidates_[i].score = rankCandidate(candidates_[i], options, result.plane_model);
+		std::make_heap(candidates_.begin(), candidates_.end(), worseCandidate);
+	}
+
+	//if clusters are touching the table keep them
+	std::vector<Candidate>::iterator end = candidates_.end();
+	for (size_t i = 0; i < candidates_.size(); i++){
+		if (top_k && (int)result.clusters.size() >= options.max_objects)
+			break;
+
+		Candidate *candidate = &candidates_[i];
+		if (top_k){
+			std::pop_heap(candidates_.begin(), end, worseCandidate);
+			--end;
+			candidate = &*end;
+		}
+
+		const PointCloudT &blob = gatherCandidate(*candidate);
+		if (blob.points.empty())
+			continue;
+
+		ClusterView view;
+		planeDistanceRange(&blob.points[0], blob.points.size(), result.plane_coefficients,
+		                   view.min_plane_distance, view.max_plane_distance);
+		if (view.min_plane_distance > params_.plane_distance_tolerance)
+			continue;
+
+		view.offset = result.cluster_points.points.size();
+		view.aggregate = candidate->aggregate;
+		if (options.full_resolution){
+			//gather the raw sensor points of the accepted cluster only
+			raw_map_.gather(blob, result.cluster_points);
+		} else {
+			result.cluster_points.points.insert(result.cluster_points.points.end(),
+			                                    blob.points.begin(), blob.points.end());
+		}
+		view.size = result.cluster_points.points.size() - view.offset;
+
+		PointT *begin = result.cluster_points.points.data() + view.offset;
+		uint64_t colour[3];
+		kernels.colour_sums(begin, view.size, colour);
+		view.mean_rgb = Eigen::Vector3f(colour[0], colour[1], colour[2]) / std::max<size_t>(view.size, 1);
+
+		if (options.levels_of_detail)
+			orderLevelsOfDetail(begin, view.size, view.lod_size);
+		else
+			std::fill(view.lod_size, view.lod_size + LOD_LEVELS, view.size);
+
+		result.clusters.push_back(view);
+	}
+
+	result.cluster_points.width = result.cluster_points.points.size();
+	result.cluster_points.height = 1;
+	result.cluster_points.is_dense = true;
+	result.cluster_points.header = cloud_->header;
+	result.blobs.header = cloud_->header;
+
+	return true;
+}
+
+}
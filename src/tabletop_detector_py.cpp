@@ -0,0 +1,244 @@
+/*
+	Python bindings for the in-process detection pipeline.
+
+	Frames are passed as NumPy structured arrays with the memory layout of
+	pcl::PointXYZRGB (see POINT_DTYPE) and are read in place. Results are
+	returned as NumPy views over the buffers of the TabletopResult they came
+	from; the arrays keep that result alive, so nothing is copied on the way
+	in or out. The GIL is released while the pipeline runs, so detectors in
+	different Python threads process frames in parallel.
+
+	import numpy as np
+	from bimur_robot_vision import tabletop_detector
+
+	detector = tabletop_detector.Detector()
+	frame = np.zeros(n, dtype=tabletop_detector.POINT_DTYPE)
+	result = detector.detect(frame, max_objects=3)
+	for i in range(result.num_clusters):
+		points = result.cluster(i)
+*/
+
+#include <stdint.h>
+#include <cstring>
+#include <boost/thread/mutex.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+#include "bimur_robot_vision/tabletop_detector.h"
+
+namespace py = pybind11;
+using namespace bimur_robot_vision;
+
+typedef pcl::PointXYZRGB PointT;
+typedef pcl::PointCloud<PointT> PointCloudT;
+
+/*
+	Function: pointDtype()
+	Inputs  : None
+	Outputs : py::dtype
+	Purpose : structured dtype matching the memory layout of pcl::PointXYZRGB
+*/
+static py::dtype pointDtype(){
+	py::list names, formats, offsets;
+	names.append("x");   formats.append("<f4"); offsets.append(offsetof(PointT, x));
+	names.append("y");   formats.append("<f4"); offsets.append(offsetof(PointT, y));
+	names.append("z");   formats.append("<f4"); offsets.append(offsetof(PointT, z));
+	names.append("rgba"); formats.append("<u4"); offsets.append(offsetof(PointT, rgba));
+
+	py::dict spec;
+	spec["names"] = names;
+	spec["formats"] = formats;
+	spec["offsets"] = offsets;
+	spec["itemsize"] = sizeof(PointT);
+	return py::dtype::from_args(spec);
+}
+
+/*
+	Function: coefficientsView()
+	Inputs  : const Eigen::Vector4f&, py::handle
+	Outputs : py::array
+	Purpose : read-only array over plane coefficients of a result, owned by base
+*/
+static py::array coefficientsView(const Eigen::Vector4f &coefficients, py::handle base){
+	py::array_t<float> view(4, coefficients.data(), base);
+	view.attr("setflags")(py::arg("write") = false);
+	return view;
+}
+
+/* a result shared between the Python object and the arrays viewing it */
+struct PyResult
+{
+	boost::shared_ptr<TabletopResult> result;
+	bool levels_of_detail;
+};
+
+/*
+	Function: pointsView()
+	Inputs  : const PointCloudT&, size_t, size_t, py::handle
+	Outputs : py::array
+	Purpose : read-only array over points of a result, owned by base
+*/
+static py::array pointsView(const PointCloudT &cloud, size_t offset, size_t size, py::handle base){
+	const PointT *data = cloud.points.data() + offset;
+	py::array view(pointDtype(), std::vector<py::ssize_t>(1, (py::ssize_t)size),
+	               std::vector<py::ssize_t>(1, (py::ssize_t)sizeof(PointT)), data, base);
+	view.attr("setflags")(py::arg("write") = false);
+	return view;
+}
+
+/* a detector together with the lock that keeps Python threads from sharing it */
+class PyDetector
+{
+public:
+	explicit PyDetector(const DetectorParams &params) : detector_(params) {}
+
+	PyResult detect(py::array frame, const DetectOptions &options){
+		//same fields at the same offsets, other 32-byte dtypes would be reinterpreted as points
+		if (!frame.dtype().equal(pointDtype()))
+			throw py::value_error("frame must use tabletop_detector.POINT_DTYPE");
+		if (!(frame.flags() & py::array::c_style))
+			throw py::value_error("frame must be C contiguous");
+
+		PyResult out;
+		out.result.reset(new TabletopResult);
+		out.levels_of_detail = options.levels_of_detail;
+
+		const PointT *points = static_cast<const PointT *>(frame.data());
+		size_t size = (size_t)frame.size();
+
+		//the pipeline expects aligned points; only misaligned buffers are copied
+		PointCloudT aligned;
+		if (((uintptr_t)points) % 16 != 0){
+			aligned.points.resize(size);
+			memcpy(&aligned.points[0], points, size * sizeof(PointT));
+			points = &aligned.points[0];
+		}
+
+		{
+			py::gil_scoped_release release;
+			boost::mutex::scoped_lock lock(mutex_);
+			detector_.detect(FrameView(points, size), options, *out.result);
+		}
+		return out;
+	}
+
+	const DetectorParams &params() const { return detector_.params(); }
+
+private:
+	TabletopDetector detector_;
+	boost::mutex mutex_;
+};
+
+PYBIND11_MODULE(tabletop_detector, m)
+{
+	m.doc() = "In-process tabletop plane and object detection";
+	m.attr("POINT_DTYPE") = pointDtype();
+
+	py::class_<DetectorParams>(m, "DetectorParams")
+		.def(py::init<>())
+		.def_readwrite("z_min", &DetectorParams::z_min)
+		.def_readwrite("z_max", &DetectorParams::z_max)
+		.def_readwrite("x_min", &DetectorParams::x_min)
+		.def_readwrite("x_max", &DetectorParams::x_max)
+		.def_readwrite("y_min", &DetectorParams::y_min)
+		.def_readwrite("y_max", &DetectorParams::y_max)
+		.def_readwrite("leaf_size", &DetectorParams::leaf_size)
+		.def_readwrite("plane_max_iterations", &DetectorParams::plane_max_iterations)
+		.def_readwrite("plane_distance_threshold", &DetectorParams::plane_distance_threshold)
+		.def_readwrite("cluster_tolerance", &DetectorParams::cluster_tolerance)
+		.def_readwrite("min_cluster_size", &DetectorParams::min_cluster_size)
+		.def_readwrite("max_cluster_size", &DetectorParams::max_cluster_size)
+		.def_readwrite("incremental_clustering", &DetectorParams::incremental_clustering)
+		.def_readwrite("plane_distance_tolerance", &DetectorParams::plane_distance_tolerance);
+
+	py::class_<PyResult>(m, "Result")
+		.def_property_readonly("is_plane_found", [](const PyResult &r){ return r.result->is_plane_found; })
+		.def_property_readonly("plane_coefficients", [](py::object self){
+			const PyResult &r = self.cast<const PyResult &>();
+			return coefficientsView(r.result->plane_coefficients, self);
+		})
+		.def_property_readonly("plane_model", [](py::object self){
+			const PyResult &r = self.cast<const PyResult &>();
+			return coefficientsView(r.result->plane_model, self);
+		})
+		.def_property_readonly("plane", [](py::object self){
+			const PyResult &r = self.cast<const PyResult &>();
+			return pointsView(r.result->plane, 0, r.result->plane.points.size(), self);
+		})
+		.def_property_readonly("blobs", [](py::object self){
+			const PyResult &r = self.cast<const PyResult &>();
+			return pointsView(r.result->blobs, 0, r.result->blobs.points.size(), self);
+		})
+		.def_property_readonly("cluster_points", [](py::object self){
+			const PyResult &r = self.cast<const PyResult &>();
+			return pointsView(r.result->cluster_points, 0, r.result->cluster_points.points.size(), self);
+		})
+		.def_property_readonly("num_clusters", [](const PyResult &r){ return r.result->clusters.size(); })
+		.def("cluster", [](py::object self, size_t i, int level, int max_points){
+			const PyResult &r = self.cast<const PyResult &>();
+			if (i >= r.result->clusters.size())
+				throw py::index_error("cluster index out of range");
+			if ((level > 0 || max_points > 0) && !r.levels_of_detail)
+				throw py::value_error("detect with levels_of_detail=True to pick a level of detail");
+			const ClusterView &view = r.result->clusters[i];
+			return pointsView(r.result->cluster_points, view.offset, view.lodPrefix(level, max_points), self);
+		}, py::arg("i"), py::arg("level") = 0, py::arg("max_points") = 0)
+		.def_property_readonly("cluster_lod_sizes", [](const PyResult &r){
+			//points per level of detail, num_clusters x LOD_LEVELS
+			py::array_t<uint64_t> sizes(std::vector<py::ssize_t>{(py::ssize_t)r.result->clusters.size(), LOD_LEVELS});
+			uint64_t *out = sizes.mutable_data();
+			for (size_t i = 0; i < r.result->clusters.size(); i++){
+				for (int l = 0; l < LOD_LEVELS; l++)
+					out[i * LOD_LEVELS + l] = r.result->clusters[i].lod_size[l];
+			}
+			return sizes;
+		})
+		.def_property_readonly("cluster_offsets", [](const PyResult &r){
+			//offsets into cluster_points, num_clusters + 1 entries
+			py::array_t<uint64_t> offsets(r.result->clusters.size() + 1);
+			uint64_t *out = offsets.mutable_data();
+			for (size_t i = 0; i < r.result->clusters.size(); i++)
+				out[i] = r.result->clusters[i].offset;
+			out[r.result->clusters.size()] = r.result->cluster_points.points.size();
+			return offsets;
+		})
+		.def_property_readonly("cluster_centroids", [](const PyResult &r){
+			py::array_t<float> centroids(std::vector<py::ssize_t>{(py::ssize_t)r.result->clusters.size(), 3});
+			float *out = centroids.mutable_data();
+			for (size_t i = 0; i < r.result->clusters.size(); i++){
+				Eigen::Vector3f c = r.result->clusters[i].aggregate.centroid();
+				out[3 * i] = c.x();
+				out[3 * i + 1] = c.y();
+				out[3 * i + 2] = c.z();
+			}
+			return centroids;
+		});
+
+	py::class_<PyDetector>(m, "Detector")
+		.def(py::init<const DetectorParams &>(), py::arg("params") = DetectorParams())
+		.def_property_readonly("params", &PyDetector::params)
+		.def("detect", [](PyDetector &self, py::array frame, bool full_resolution, int max_objects,
+		                  const std::string &rank_by, py::object reference_point, bool levels_of_detail){
+			DetectOptions options;
+			options.full_resolution = full_resolution;
+			options.max_objects = max_objects;
+			options.levels_of_detail = levels_of_detail;
+			if (rank_by == "distance")
+				options.rank_by = RANK_BY_DISTANCE;
+			else if (rank_by == "height")
+				options.rank_by = RANK_BY_HEIGHT;
+			else if (rank_by != "size")
+				throw py::value_error("rank_by must be 'size', 'distance' or 'height'");
+			if (!reference_point.is_none()){
+				py::array_t<float, py::array::forcecast> p(reference_point);
+				if (p.size() != 3)
+					throw py::value_error("reference_point must have 3 elements");
+				options.reference_point = Eigen::Vector3f(p.at(0), p.at(1), p.at(2));
+			}
+			return self.detect(frame, options);
+		}, py::arg("frame"), py::arg("full_resolution") = false, py::arg("max_objects") = 0,
+		   py::arg("rank_by") = "size", py::arg("reference_point") = py::none(),
+		   py::arg("levels_of_detail") = false);
+}
@@ -0,0 +1,165 @@
+/*
+	Compares the two ways of getting the points of a frame into the
+	pipeline: decoding the cloud published by the camera driver with
+	pcl::fromROSMsg and cropping it to the limits of the detector, against
+	unprojecting the depth image it was made from with DepthUnprojector.
+
+	A synthetic 640x480 scene (a table with a few boxes on it, some pixels
+	without depth) is used for both, so no camera or roscore is needed.
+
+	usage: unprojection_benchmark [frames]
+*/
+
+#include <stdint.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
+#include <pcl_conversions/pcl_conversions.h>
+
+#include "bimur_robot_vision/depth_unprojector.h"
+#include "bimur_robot_vision/point_kernels.h"
+#include "bimur_robot_vision/tabletop_detector.h"
+
+typedef pcl::PointXYZRGB PointT;
+typedef pcl::PointCloud<PointT> PointCloudT;
+typedef std::chrono::steady_clock Clock;
+
+static const uint32_t WIDTH = 640;
+static const uint32_t HEIGHT = 480;
+
+/*
+	Function: makeScene()
+	Inputs  : std::vector<uint16_t>&, std::vector<uint8_t>&
+	Outputs : None
+	Purpose : depth (mm) and colour of a tilted table with three boxes on it
+*/
+static void makeScene(std::vector<uint16_t> &depth, std::vector<uint8_t> &rgb){
+	depth.assign((size_t)WIDTH * HEIGHT, 0);
+	rgb.assign((size_t)WIDTH * HEIGHT * 3, 0);
+	srand(1);
+	for (uint32_t v = 0; v < HEIGHT; v++){
+		for (uint32_t u = 0; u < WIDTH; u++){
+			size_t i = (size_t)v * WIDTH + u;
+			//table seen from above at an angle, further away towards the top of the image
+			float z = 0.7f + 0.8f * (HEIGHT - v) / HEIGHT;
+			uint8_t shade = 160;
+			for (int b = 0; b < 3; b++){
+				int cu = 200 + 120 * b, cv = 260 + 30 * b;
+				if (abs((int)u - cu) < 40 && abs((int)v - cv) < 50){
+					z -= 0.1f;
+					shade = 60 + 60 * b;
+				}
+			}
+			//a few holes, as from reflections and shadows
+			if (rand() % 50 == 0)
+				continue;
+			depth[i] = (uint16_t)(z * 1000.0f);
+			rgb[3 * i] = shade;
+			rgb[3 * i + 1] = shade / 2;
+			rgb[3 * i + 2] = 255 - shade;
+		}
+	}
+}
+
+/*
+	Function: makeDriverCloud()
+	Inputs  : const bimur_robot_vision::CameraIntrinsics&, const std::vector<uint16_t>&, const std::vector<uint8_t>&, sensor_msgs::PointCloud2&
+	Outputs : None
+	Purpose : organized x, y, z, rgb cloud as published by the camera driver,
+	          NaN where there is no depth
+*/
+static void makeDriverCloud(const bimur_robot_vision::CameraIntrinsics &camera, const std::vector<uint16_t> &depth,
+                            const std::vector<uint8_t> &rgb, sensor_msgs::PointCloud2 &msg){
+	msg.header.frame_id = "camera_depth_optical_frame";
+	msg.width = WIDTH;
+	msg.height = HEIGHT;
+	msg.is_dense = false;
+	sensor_msgs::PointCloud2Modifier modifier(msg);
+	modifier.setPointCloud2Fields(4,
+		"x", 1, sensor_msgs::PointField::FLOAT32,
+		"y", 1, sensor_msgs::PointField::FLOAT32,
+		"z", 1, sensor_msgs::PointField::FLOAT32,
+		"rgb", 1, sensor_msgs::PointField::FLOAT32);
+	modifier.resize((size_t)WIDTH * HEIGHT);
+
+	sensor_msgs::PointCloud2Iterator<float> x(msg, "x");
+	sensor_msgs::PointCloud2Iterator<uint8_t> colour(msg, "rgb");
+	for (uint32_t v = 0; v < HEIGHT; v++){
+		for (uint32_t u = 0; u < WIDTH; u++, ++x, ++colour){
+			size_t i = (size_t)v * WIDTH + u;
+			float z = depth[i] * 0.001f;
+			if (depth[i] == 0){
+				x[0] = x[1] = x[2] = NAN;
+			} else {
+				x[0] = (u - camera.cx) / camera.fx * z;
+				x[1] = (v - camera.cy) / camera.fy * z;
+				x[2] = z;
+			}
+			colour[0] = rgb[3 * i + 2];
+			colour[1] = rgb[3 * i + 1];
+			colour[2] = rgb[3 * i];
+		}
+	}
+}
+
+int main(int argc, char **argv){
+	int frames = argc > 1 ? atoi(argv[1]) : 200;
+	if (frames <= 0)
+		frames = 200;
+
+	bimur_robot_vision::CameraIntrinsics camera;
+	camera.fx = camera.fy = 615.0f;
+	camera.cx = 320.0f;
+	camera.cy = 240.0f;
+	camera.width = WIDTH;
+	camera.height = HEIGHT;
+	camera.valid = true;
+
+	std::vector<uint16_t> depth;
+	std::vector<uint8_t> rgb;
+	makeScene(depth, rgb);
+	sensor_msgs::PointCloud2 msg;
+	makeDriverCloud(camera, depth, rgb, msg);
+
+	//the limits the node applies
+	bimur_robot_vision::DetectorParams params;
+	const float lo[3] = {params.x_min, params.y_min, params.z_min};
+	const float hi[3] = {params.x_max, params.y_max, params.z_max};
+	const bimur_robot_vision::PointKernels &kernels = bimur_robot_vision::pointKernels();
+
+	//driver cloud: decode, then crop to the limits
+	PointCloudT decoded;
+	size_t decoded_points = 0;
+	Clock::time_point start = Clock::now();
+	for (int f = 0; f < frames; f++){
+		pcl::fromROSMsg(msg, decoded);
+		decoded_points = kernels.crop(&decoded.points[0], decoded.points.size(), lo, hi, &decoded.points[0]);
+		decoded.points.resize(decoded_points);
+	}
+	double decode_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / frames;
+
+	//depth image: ray table once, then unproject with the limits fused in
+	bimur_robot_vision::DepthUnprojector unprojector;
+	start = Clock::now();
+	unprojector.setCamera(camera, std::vector<double>());
+	double table_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	unprojector.setLimits(lo, hi);
+
+	PointCloudT unprojected;
+	start = Clock::now();
+	for (int f = 0; f < frames; f++)
+		unprojector.unproject(&depth[0], WIDTH * sizeof(uint16_t), &rgb[0], WIDTH * 3, WIDTH, HEIGHT, 0.001f,
+		                      unprojected);
+	double unproject_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / frames;
+
+	printf("kernels: %s, %ux%u, %d frames\n", kernels.name, WIDTH, HEIGHT, frames);
+	printf("fromROSMsg + crop : %8.3f ms/frame, %zu points\n", decode_ms, decoded_points);
+	printf("unproject         : %8.3f ms/frame, %zu points (ray table %.3f ms, once)\n", unproject_ms,
+	       unprojected.points.size(), table_ms);
+	return 0;
+}
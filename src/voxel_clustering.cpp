@@ -0,0 +1,336 @@
+/*
+	Incremental euclidean clustering over a voxel grid, see voxel_clustering.h
+*/
+
+#include <algorithm>
+#include <limits>
+
+#include "bimur_robot_vision/voxel_clustering.h"
+
+namespace bimur_robot_vision
+{
+
+ClusterAggregate::ClusterAggregate()
+	: count(0),
+	  sum(Eigen::Vector3d::Zero()),
+	  sum_sq(Eigen::Matrix3d::Zero()),
+	  sum_rgb(Eigen::Vector3d::Zero()),
+	  min_voxel(Eigen::Vector3i::Constant(std::numeric_limits<int>::max())),
+	  max_voxel(Eigen::Vector3i::Constant(std::numeric_limits<int>::min()))
+{
+}
+
+void ClusterAggregate::add(const pcl::PointXYZRGB &p){
+	Eigen::Vector3d v(p.x, p.y, p.z);
+	count++;
+	sum += v;
+	sum_sq += v * v.transpose();
+	sum_rgb += Eigen::Vector3d(p.r, p.g, p.b);
+}
+
+void ClusterAggregate::remove(const pcl::PointXYZRGB &p){
+	Eigen::Vector3d v(p.x, p.y, p.z);
+	count--;
+	sum -= v;
+	sum_sq -= v * v.transpose();
+	sum_rgb -= Eigen::Vector3d(p.r, p.g, p.b);
+}
+
+void ClusterAggregate::merge(const ClusterAggregate &other){
+	count += other.count;
+	sum += other.sum;
+	sum_sq += other.sum_sq;
+	sum_rgb += other.sum_rgb;
+	min_voxel = min_voxel.cwiseMin(other.min_voxel);
+	max_voxel = max_voxel.cwiseMax(other.max_voxel);
+}
+
+void ClusterAggregate::expand(const Eigen::Vector3i &voxel){
+	min_voxel = min_voxel.cwiseMin(voxel);
+	max_voxel = max_voxel.cwiseMax(voxel);
+}
+
+Eigen::Vector3f ClusterAggregate::centroid() const {
+	if (count == 0)
+		return Eigen::Vector3f::Zero();
+	return (sum / count).cast<float>();
+}
+
+Eigen::Matrix3f ClusterAggregate::covariance() const {
+	if (count == 0)
+		return Eigen::Matrix3f::Zero();
+	Eigen::Vector3d mean = sum / count;
+	return (sum_sq / count - mean * mean.transpose()).cast<float>();
+}
+
+
+IncrementalVoxelClustering::IncrementalVoxelClustering(float leaf_size, float tolerance)
+	: leaf_size_(leaf_size),
+	  inverse_leaf_(1.0f / leaf_size),
+	  tolerance_(tolerance),
+	  frame_(0),
+	  num_added_(0),
+	  num_removed_(0)
+{
+	cell_voxels_ = std::max(1, (int)std::ceil(tolerance_ / leaf_size_));
+}
+
+void IncrementalVoxelClustering::reset(){
+	keys_.clear();
+	voxels_.clear();
+	points_.clear();
+	parent_.clear();
+	alive_.clear();
+	last_seen_.clear();
+	members_.clear();
+	aggregates_.clear();
+	free_.clear();
+	index_.clear();
+	cells_.clear();
+}
+
+void IncrementalVoxelClustering::setTolerance(float tolerance){
+	if (tolerance == tolerance_)
+		return;
+	tolerance_ = tolerance;
+	cell_voxels_ = std::max(1, (int)std::ceil(tolerance_ / leaf_size_));
+	reset();
+}
+
+VoxelKey IncrementalVoxelClustering::cellKeyOf(const Eigen::Vector3i &voxel) const {
+	//floor division so that negative coordinates land in the right cell
+	int cx = voxel.x() >= 0 ? voxel.x() / cell_voxels_ : -((-voxel.x() - 1) / cell_voxels_) - 1;
+	int cy = voxel.y() >= 0 ? voxel.y() / cell_voxels_ : -((-voxel.y() - 1) / cell_voxels_) - 1;
+	int cz = voxel.z() >= 0 ? voxel.z() / cell_voxels_ : -((-voxel.z() - 1) / cell_voxels_) - 1;
+	return packVoxelKey(cx, cy, cz);
+}
+
+int IncrementalVoxelClustering::allocSlot(VoxelKey key, const Eigen::Vector3i &voxel, const PointT &p){
+	int s;
+	if (!free_.empty()){
+		s = free_.back();
+		free_.pop_back();
+	} else {
+		s = (int)keys_.size();
+		keys_.push_back(0);
+		voxels_.push_back(Eigen::Vector3i::Zero());
+		points_.push_back(p);
+		parent_.push_back(s);
+		alive_.push_back(0);
+		last_seen_.push_back(0);
+		members_.push_back(std::vector<int>());
+		aggregates_.push_back(ClusterAggregate());
+	}
+
+	keys_[s] = key;
+	voxels_[s] = voxel;
+	points_[s] = p;
+	parent_[s] = s;
+	alive_[s] = 1;
+	last_seen_[s] = frame_;
+	members_[s].assign(1, s);
+	aggregates_[s] = ClusterAggregate();
+	aggregates_[s].add(p);
+	aggregates_[s].expand(voxel);
+
+	index_[key] = s;
+	cells_[cellKeyOf(voxel)].push_back(s);
+	return s;
+}
+
+void IncrementalVoxelClustering::freeSlot(int s){
+	index_.erase(keys_[s]);
+
+	boost::unordered_map<VoxelKey, std::vector<int> >::iterator cell = cells_.find(cellKeyOf(voxels_[s]));
+	if (cell != cells_.end()){
+		std::vector<int> &slots = cell->second;
+		std::vector<int>::iterator it = std::find(slots.begin(), slots.end(), s);
+		if (it != slots.end()){
+			*it = slots.back();
+			slots.pop_back();
+		}
+		if (slots.empty())
+			cells_.erase(cell);
+	}
+
+	alive_[s] = 0;
+	members_[s].clear();
+}
+
+int IncrementalVoxelClustering::find(int s){
+	while (parent_[s] != s){
+		parent_[s] = parent_[parent_[s]];
+		s = parent_[s];
+	}
+	return s;
+}
+
+void IncrementalVoxelClustering::unite(int a, int b){
+	int ra = find(a);
+	int rb = find(b);
+	if (ra == rb)
+		return;
+
+	//small-to-large, so every voxel is moved O(log n) times
+	if (members_[ra].size() < members_[rb].size())
+		std::swap(ra, rb);
+
+	parent_[rb] = ra;
+	members_[ra].insert(members_[ra].end(), members_[rb].begin(), members_[rb].end());
+	std::vector<int>().swap(members_[rb]);
+	aggregates_[ra].merge(aggregates_[rb]);
+}
+
+template <typename F>
+void IncrementalVoxelClustering::forEachNeighbour(int s, F f){
+	const Eigen::Vector3i &v = voxels_[s];
+	const float tolerance_sq = tolerance_ * tolerance_;
+	const float leaf_sq = leaf_size_ * leaf_size_;
+
+	VoxelKey center = cellKeyOf(v);
+	int cx = (int)((center >> 42) & ((1u << 21) - 1)) - (1 << 20);
+	int cy = (int)((center >> 21) & ((1u << 21) - 1)) - (1 << 20);
+	int cz = (int)(center & ((1u << 21) - 1)) - (1 << 20);
+
+	for (int dx = -1; dx <= 1; dx++)
+	for (int dy = -1; dy <= 1; dy++)
+	for (int dz = -1; dz <= 1; dz++){
+		boost::unordered_map<VoxelKey, std::vector<int> >::const_iterator cell =
+			cells_.find(packVoxelKey(cx + dx, cy + dy, cz + dz));
+		if (cell == cells_.end())
+			continue;
+
+		for (std::vector<int>::const_iterator it = cell->second.begin(); it != cell->second.end(); ++it){
+			if (*it == s || !alive_[*it])
+				continue;
+			//connectivity is decided on voxel centres so it is stable across frames
+			Eigen::Vector3i d = voxels_[*it] - v;
+			if ((float)d.squaredNorm() * leaf_sq <= tolerance_sq)
+				f(*it);
+		}
+	}
+}
+
+void IncrementalVoxelClustering::rebuildComponent(int root){
+	std::vector<int> members;
+	members.swap(members_[root]);
+
+	//detach every surviving voxel ...
+	for (std::vector<int>::const_iterator it = members.begin(); it != members.end(); ++it){
+		if (!alive_[*it])
+			continue;
+		parent_[*it] = *it;
+		members_[*it].assign(1, *it);
+		aggregates_[*it] = ClusterAggregate();
+		aggregates_[*it].add(points_[*it]);
+		aggregates_[*it].expand(voxels_[*it]);
+	}
+
+	//... and reconnect them, which splits the component where needed
+	for (std::vector<int>::const_iterator it = members.begin(); it != members.end(); ++it){
+		if (!alive_[*it])
+			continue;
+		int s = *it;
+		forEachNeighbour(s, [this, s](int n){ unite(s, n); });
+	}
+}
+
+void IncrementalVoxelClustering::update(const PointCloudT &voxels){
+	frame_++;
+	num_added_ = 0;
+	num_removed_ = 0;
+
+	//match the new voxels against the current state
+	std::vector<int> added;
+	for (size_t i = 0; i < voxels.points.size(); i++){
+		const PointT &p = voxels.points[i];
+		if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+			continue;
+
+		Eigen::Vector3i voxel(voxelCoord(p.x, inverse_leaf_),
+		                      voxelCoord(p.y, inverse_leaf_),
+		                      voxelCoord(p.z, inverse_leaf_));
+		VoxelKey key = packVoxelKey(voxel.x(), voxel.y(), voxel.z());
+
+		boost::unordered_map<VoxelKey, int>::iterator it = index_.find(key);
+		if (it == index_.end()){
+			added.push_back(allocSlot(key, voxel, p));
+			continue;
+		}
+
+		int s = it->second;
+		if (last_seen_[s] == frame_)
+			continue;
+		last_seen_[s] = frame_;
+
+		//persistent voxel, only its centroid and colour may have moved
+		ClusterAggregate &agg = aggregates_[find(s)];
+		agg.remove(points_[s]);
+		agg.add(p);
+		points_[s] = p;
+	}
+
+	//voxels not seen this frame disappeared; their components may split
+	std::vector<int> removed;
+	std::vector<int> dirty;
+	for (size_t s = 0; s < alive_.size(); s++){
+		if (alive_[s] && last_seen_[s] != frame_){
+			removed.push_back((int)s);
+			dirty.push_back(find((int)s));
+		}
+	}
+	std::sort(dirty.begin(), dirty.end());
+	dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+	for (size_t i = 0; i < removed.size(); i++)
+		alive_[removed[i]] = 0;
+	for (size_t i = 0; i < dirty.size(); i++)
+		rebuildComponent(dirty[i]);
+	for (size_t i = 0; i < removed.size(); i++)
+		freeSlot(removed[i]);
+	//slots are only recycled once nothing refers to them anymore
+	free_.insert(free_.end(), removed.begin(), removed.end());
+
+	//new voxels join (and possibly merge) their neighbours
+	for (size_t i = 0; i < added.size(); i++){
+		int s = added[i];
+		forEachNeighbour(s, [this, s](int n){ unite(s, n); });
+	}
+
+	num_added_ = (int)added.size();
+	num_removed_ = (int)removed.size();
+}
+
+static bool largerCluster(const VoxelCluster &a, const VoxelCluster &b){
+	return a.aggregate.count > b.aggregate.count;
+}
+
+void IncrementalVoxelClustering::clusters(int min_size, int max_size, std::vector<VoxelCluster> &out) const {
+	out.clear();
+	for (size_t s = 0; s < alive_.size(); s++){
+		if (!alive_[s] || parent_[s] != (int)s)
+			continue;
+		const ClusterAggregate &agg = aggregates_[s];
+		if (agg.count < min_size || agg.count > max_size)
+			continue;
+		VoxelCluster c;
+		c.id = (int)s;
+		c.aggregate = agg;
+		out.push_back(c);
+	}
+	std::sort(out.begin(), out.end(), largerCluster);
+}
+
+void IncrementalVoxelClustering::gather(int id, PointCloudT &out) const {
+	const std::vector<int> &members = members_[id];
+	out.points.reserve(out.points.size() + members.size());
+	for (std::vector<int>::const_iterator it = members.begin(); it != members.end(); ++it){
+		if (alive_[*it])
+			out.points.push_back(points_[*it]);
+	}
+	out.width = out.points.size();
+	out.height = 1;
+	out.is_dense = true;
+}
+
+}
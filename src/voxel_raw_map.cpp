@@ -0,0 +1,82 @@
+/*
+	Voxel to raw point mapping, see voxel_raw_map.h
+*/
+
+#include <cmath>
+
+#include "bimur_robot_vision/voxel_raw_map.h"
+
+namespace bimur_robot_vision
+{
+
+VoxelRawMap::VoxelRawMap(float leaf_size)
+	: inverse_leaf_(1.0f / leaf_size)
+{
+}
+
+void VoxelRawMap::clear(){
+	raw_.reset();
+	ranges_.clear();
+	order_.clear();
+}
+
+void VoxelRawMap::build(const PointCloudT::ConstPtr &raw){
+	clear();
+	raw_ = raw;
+
+	const std::vector<PointT, Eigen::aligned_allocator<PointT> > &points = raw->points;
+	std::vector<VoxelKey> keys(points.size());
+	std::vector<char> valid(points.size(), 0);
+
+	//first pass: count the points of every voxel
+	for (size_t i = 0; i < points.size(); i++){
+		const PointT &p = points[i];
+		if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+			continue;
+		keys[i] = packVoxelKey(voxelCoord(p.x, inverse_leaf_),
+		                       voxelCoord(p.y, inverse_leaf_),
+		                       voxelCoord(p.z, inverse_leaf_));
+		valid[i] = 1;
+		ranges_[keys[i]].second++;
+	}
+
+	//prefix sums give every voxel its slice of order_
+	int offset = 0;
+	for (boost::unordered_map<VoxelKey, std::pair<int, int> >::iterator it = ranges_.begin(); it != ranges_.end(); ++it){
+		it->second.first = offset;
+		offset += it->second.second;
+		it->second.second = 0;
+	}
+
+	//second pass: scatter the indices
+	order_.resize(offset);
+	for (size_t i = 0; i < points.size(); i++){
+		if (!valid[i])
+			continue;
+		std::pair<int, int> &range = ranges_[keys[i]];
+		order_[range.first + range.second] = (int)i;
+		range.second++;
+	}
+}
+
+void VoxelRawMap::gather(const PointCloudT &voxels, PointCloudT &out) const {
+	if (!raw_)
+		return;
+
+	for (size_t i = 0; i < voxels.points.size(); i++){
+		const PointT &v = voxels.points[i];
+		VoxelKey key = packVoxelKey(voxelCoord(v.x, inverse_leaf_),
+		                            voxelCoord(v.y, inverse_leaf_),
+		                            voxelCoord(v.z, inverse_leaf_));
+		boost::unordered_map<VoxelKey, std::pair<int, int> >::const_iterator it = ranges_.find(key);
+		if (it == ranges_.end())
+			continue;
+		for (int j = it->second.first; j < it->second.first + it->second.second; j++)
+			out.points.push_back(raw_->points[order_[j]]);
+	}
+	out.width = out.points.size();
+	out.height = 1;
+	out.is_dense = true;
+}
+
+}
@@ -0,0 +1,335 @@
+/*
+	Checks the detection history: time-range queries on the ring, dropping
+	the oldest detections when either ring is full, and the spill file
+	(range queries, cutting off what a crash left behind, time order
+	across restarts).
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "bimur_robot_vision/detection_history.h"
+
+using namespace bimur_robot_vision;
+
+static const uint64_t FIRST_STAMP = 1000000;
+static const uint64_t PERIOD = 100000;
+
+//sizes in the spill file format: magic, detection record, object record
+static const long MAGIC_SIZE = 8;
+static const long RECORD_SIZE = 40;
+static const long OBJECT_SIZE = 40;
+
+/*
+	Function: detection()
+	Inputs  : uint64_t
+	Outputs : DetectionSummary
+	Purpose : summary number t of a test run, with t % 5 objects
+*/
+static DetectionSummary detection(uint64_t t){
+	DetectionSummary out;
+	out.stamp = FIRST_STAMP + t * PERIOD;
+	out.is_plane_found = t % 3 != 0;
+	for (int k = 0; k < 4; k++)
+		out.plane[k] = (float)(t + k);
+	out.objects.resize(t % 5);
+	for (size_t j = 0; j < out.objects.size(); j++){
+		ObjectSummary &object = out.objects[j];
+		object.id = (int)(10 * t + j);
+		object.type = j % 2 ? PRIMITIVE_CYLINDER : PRIMITIVE_BOX;
+		object.points = (uint32_t)(100 + j);
+		object.rgb = (uint32_t)t;
+		for (int k = 0; k < 3; k++){
+			object.centroid[k] = (float)(t + j + k);
+			object.dimensions[k] = 0.01f * k;
+		}
+	}
+	return out;
+}
+
+static void expectDetection(uint64_t t, const DetectionSummary &actual){
+	DetectionSummary expected = detection(t);
+	EXPECT_EQ(expected.stamp, actual.stamp);
+	EXPECT_EQ(expected.is_plane_found, actual.is_plane_found);
+	for (int k = 0; k < 4; k++)
+		EXPECT_EQ(expected.plane[k], actual.plane[k]);
+	ASSERT_EQ(expected.objects.size(), actual.objects.size());
+	for (size_t j = 0; j < expected.objects.size(); j++){
+		EXPECT_EQ(expected.objects[j].id, actual.objects[j].id);
+		EXPECT_EQ(expected.objects[j].type, actual.objects[j].type);
+		EXPECT_EQ(expected.objects[j].points, actual.objects[j].points);
+		EXPECT_EQ(expected.objects[j].rgb, actual.objects[j].rgb);
+		for (int k = 0; k < 3; k++){
+			EXPECT_EQ(expected.objects[j].centroid[k], actual.objects[j].centroid[k]);
+			EXPECT_EQ(expected.objects[j].dimensions[k], actual.objects[j].dimensions[k]);
+		}
+	}
+}
+
+static long fileSize(const std::string &path){
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return -1;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+static void appendBytes(const std::string &path, size_t size){
+	FILE *file = fopen(path.c_str(), "ab");
+	std::vector<char> bytes(size, 0x5a);
+	fwrite(&bytes[0], 1, size, file);
+	fclose(file);
+}
+
+/* a spill file of its own for every test, removed afterwards */
+class SpillFileTest : public testing::Test
+{
+protected:
+	void SetUp(){
+		path_ = "/tmp/bimur_test_detection_history_" + std::to_string(getpid()) + "_" +
+		        testing::UnitTest::GetInstance()->current_test_info()->name();
+		objects_path_ = path_ + ".objects";
+		TearDown();
+	}
+
+	void TearDown(){
+		remove(path_.c_str());
+		remove(objects_path_.c_str());
+	}
+
+	//spills detections [first, last) through a fresh history
+	void spill(uint64_t first, uint64_t last){
+		DetectionHistory history;
+		ASSERT_TRUE(history.spillTo(path_));
+		for (uint64_t t = first; t < last; t++){
+			ASSERT_TRUE(history.add(detection(t)));
+			ASSERT_TRUE(history.lastSpilled());
+		}
+	}
+
+	//every spilled detection must be detection 0, 1, ..., count - 1
+	void expectSpilled(uint64_t count){
+		std::vector<DetectionSummary> out;
+		ASSERT_TRUE(DetectionHistory::readSpilled(path_, 0, UINT64_MAX, 0, out));
+		ASSERT_EQ(count, out.size());
+		for (uint64_t t = 0; t < count; t++)
+			expectDetection(t, out[t]);
+	}
+
+	std::string path_;
+	std::string objects_path_;
+};
+
+TEST(DetectionHistory, RangeFindsStampsWithinBounds){
+	DetectionHistory history;
+	history.setCapacity(100, 1000);
+	for (uint64_t t = 0; t < 50; t++)
+		ASSERT_TRUE(history.add(detection(t)));
+	ASSERT_EQ(50u, history.size());
+
+	size_t first, last;
+	history.range(detection(10).stamp, detection(20).stamp, first, last);
+	EXPECT_EQ(10u, first);
+	EXPECT_EQ(21u, last);
+
+	//bounds between stamps
+	history.range(detection(10).stamp + 1, detection(20).stamp - 1, first, last);
+	EXPECT_EQ(11u, first);
+	EXPECT_EQ(20u, last);
+
+	//before, after and reversed
+	history.range(0, FIRST_STAMP - 1, first, last);
+	EXPECT_EQ(first, last);
+	history.range(detection(50).stamp, UINT64_MAX, first, last);
+	EXPECT_EQ(first, last);
+	history.range(detection(20).stamp, detection(10).stamp, first, last);
+	EXPECT_EQ(first, last);
+
+	DetectionSummary out;
+	for (size_t i = 0; i < history.size(); i++){
+		history.get(i, out);
+		expectDetection(i, out);
+	}
+}
+
+TEST(DetectionHistory, RejectsOutOfOrderDetections){
+	DetectionHistory history;
+	history.setCapacity(10, 100);
+	ASSERT_TRUE(history.add(detection(5)));
+	EXPECT_FALSE(history.add(detection(4)));
+	EXPECT_EQ(1u, history.size());
+	//repeated stamps are in order
+	EXPECT_TRUE(history.add(detection(5)));
+	EXPECT_EQ(2u, history.size());
+}
+
+TEST(DetectionHistory, DropsOldestWhenDetectionRingIsFull){
+	DetectionHistory history;
+	history.setCapacity(10, 1000);
+	for (uint64_t t = 0; t < 25; t++)
+		ASSERT_TRUE(history.add(detection(t)));
+	ASSERT_EQ(10u, history.size());
+
+	DetectionSummary out;
+	for (size_t i = 0; i < history.size(); i++){
+		history.get(i, out);
+		expectDetection(15 + i, out);
+	}
+}
+
+TEST(DetectionHistory, DropsOldestWhenObjectRingOverflows){
+	//room for many detections but few objects: objects decide what is kept
+	DetectionHistory history;
+	history.setCapacity(100, 10);
+	for (uint64_t t = 0; t < 40; t++){
+		ASSERT_TRUE(history.add(detection(t)));
+
+		size_t objects = 0;
+		for (size_t i = 0; i < history.size(); i++)
+			objects += history.numObjects(i);
+		ASSERT_LE(objects, 10u);
+
+		//the newest detections are kept, in order, and the one just added is whole
+		DetectionSummary out;
+		uint64_t oldest = t + 1 - history.size();
+		for (size_t i = 0; i < history.size(); i++){
+			history.get(i, out);
+			expectDetection(oldest + i, out);
+		}
+	}
+
+	//detections 35 to 39 hold 0 + 1 + 2 + 3 + 4 objects and fill the object ring
+	EXPECT_EQ(detection(35).stamp, history.stamp(0));
+}
+
+TEST(DetectionHistory, KeepsFirstObjectsOfOversizedDetection){
+	DetectionHistory history;
+	history.setCapacity(10, 3);
+	ASSERT_TRUE(history.add(detection(1)));
+	ASSERT_TRUE(history.add(detection(4)));
+	ASSERT_EQ(1u, history.size());
+	ASSERT_EQ(3u, history.numObjects(0));
+	for (size_t j = 0; j < 3; j++)
+		EXPECT_EQ(40 + (int)j, history.object(0, j).id);
+}
+
+TEST_F(SpillFileTest, ReadsRangesFromSpillFile){
+	spill(0, 1000);
+	expectSpilled(1000);
+
+	std::vector<DetectionSummary> out;
+	for (uint64_t begin = 0; begin < 1000; begin += 37){
+		ASSERT_TRUE(DetectionHistory::readSpilled(path_, detection(begin).stamp - 1, detection(begin + 9).stamp, 0,
+		                                          out));
+		ASSERT_EQ(std::min<uint64_t>(10, 1000 - begin), out.size());
+		for (size_t i = 0; i < out.size(); i++)
+			expectDetection(begin + i, out[i]);
+	}
+
+	//at most max of them, oldest first
+	ASSERT_TRUE(DetectionHistory::readSpilled(path_, detection(500).stamp, UINT64_MAX, 4, out));
+	ASSERT_EQ(4u, out.size());
+	expectDetection(500, out[0]);
+
+	//nothing in range
+	ASSERT_TRUE(DetectionHistory::readSpilled(path_, detection(1000).stamp, UINT64_MAX, 0, out));
+	EXPECT_TRUE(out.empty());
+	ASSERT_TRUE(DetectionHistory::readSpilled(path_, 0, FIRST_STAMP - 1, 0, out));
+	EXPECT_TRUE(out.empty());
+
+	EXPECT_FALSE(DetectionHistory::readSpilled(path_ + ".missing", 0, UINT64_MAX, 0, out));
+}
+
+TEST_F(SpillFileTest, SpillsPastTheRing){
+	DetectionHistory history;
+	history.setCapacity(10, 30);
+	ASSERT_TRUE(history.spillTo(path_));
+	for (uint64_t t = 0; t < 100; t++)
+		ASSERT_TRUE(history.add(detection(t)));
+	EXPECT_EQ(10u, history.size());
+	expectSpilled(100);
+}
+
+TEST_F(SpillFileTest, CutsTornRecordOnReopen){
+	spill(0, 100);
+	ASSERT_EQ(MAGIC_SIZE + 100 * RECORD_SIZE, fileSize(path_));
+	appendBytes(path_, 13);
+
+	spill(100, 150);
+	expectSpilled(150);
+	EXPECT_EQ(MAGIC_SIZE + 150 * RECORD_SIZE, fileSize(path_));
+}
+
+TEST_F(SpillFileTest, CutsRecordWithMissingObjects){
+	spill(0, 100);
+	//detections 0 to 99 hold 200 objects, the last 4 of them detection 99's; lose two
+	ASSERT_EQ(MAGIC_SIZE + 200 * OBJECT_SIZE, fileSize(objects_path_));
+	ASSERT_EQ(0, truncate(objects_path_.c_str(), MAGIC_SIZE + 198 * OBJECT_SIZE));
+
+	spill(99, 120);
+	expectSpilled(120);
+}
+
+TEST_F(SpillFileTest, CutsObjectsWithoutRecord){
+	spill(0, 10);
+	appendBytes(objects_path_, 100);
+	spill(10, 20);
+	expectSpilled(20);
+	//detections 0 to 19 hold 40 objects
+	EXPECT_EQ(MAGIC_SIZE + 40 * OBJECT_SIZE, fileSize(objects_path_));
+}
+
+TEST_F(SpillFileTest, RestartsFileCutWithinMagic){
+	FILE *file = fopen(path_.c_str(), "wb");
+	fwrite("BIMU", 1, 4, file);
+	fclose(file);
+	spill(0, 5);
+	expectSpilled(5);
+}
+
+TEST_F(SpillFileTest, RejectsOtherFiles){
+	FILE *file = fopen(path_.c_str(), "wb");
+	fputs("not a history file", file);
+	fclose(file);
+	DetectionHistory history;
+	EXPECT_FALSE(history.spillTo(path_));
+	std::vector<DetectionSummary> out;
+	EXPECT_FALSE(DetectionHistory::readSpilled(path_, 0, UINT64_MAX, 0, out));
+}
+
+TEST_F(SpillFileTest, KeepsTimeOrderAcrossRestarts){
+	spill(0, 50);
+
+	//a new run whose clock starts over: in memory, but not in the file
+	DetectionHistory history;
+	history.setCapacity(100, 1000);
+	ASSERT_TRUE(history.spillTo(path_));
+	ASSERT_TRUE(history.add(detection(10)));
+	EXPECT_FALSE(history.lastSpilled());
+	EXPECT_EQ(1u, history.size());
+
+	//once past the newest spilled detection, spilling goes on
+	ASSERT_TRUE(history.add(detection(50)));
+	EXPECT_TRUE(history.lastSpilled());
+	expectSpilled(51);
+
+	//still sorted, so the binary search finds every range
+	std::vector<DetectionSummary> out;
+	ASSERT_TRUE(DetectionHistory::readSpilled(path_, detection(45).stamp, detection(50).stamp, 0, out));
+	ASSERT_EQ(6u, out.size());
+	for (size_t i = 0; i < out.size(); i++)
+		expectDetection(45 + i, out[i]);
+}
+
+int main(int argc, char **argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,302 @@
+/*
+	Checks every SIMD point kernel the CPU supports against the scalar
+	reference, on random inputs of every size up to a few vector widths so
+	that the leftover points handed to the scalar code are covered too.
+*/
+
+#include <stdint.h>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+#include "bimur_robot_vision/point_kernels.h"
+
+using namespace bimur_robot_vision;
+
+typedef pcl::PointXYZRGB PointT;
+typedef pcl::PointCloud<PointT> PointCloudT;
+
+static const char *isa_names[] = {"sse42", "avx2", "avx512"};
+
+//every size up to three AVX-512 widths, then a few longer runs
+static std::vector<size_t> testSizes(){
+	std::vector<size_t> sizes;
+	for (size_t n = 0; n <= 48; n++)
+		sizes.push_back(n);
+	sizes.push_back(101);
+	sizes.push_back(1000);
+	return sizes;
+}
+
+static float randomFloat(float lo, float hi){
+	return lo + (hi - lo) * (float)rand() / (float)RAND_MAX;
+}
+
+/*
+	Function: randomPoints()
+	Inputs  : size_t, PointCloudT&
+	Outputs : None
+	Purpose : points in a 4 m cube with random colours
+*/
+static void randomPoints(size_t size, PointCloudT &out){
+	out.points.resize(size);
+	for (size_t i = 0; i < size; i++){
+		PointT &p = out.points[i];
+		p.x = randomFloat(-2.0f, 2.0f);
+		p.y = randomFloat(-2.0f, 2.0f);
+		p.z = randomFloat(0.0f, 4.0f);
+		p.data[3] = 1.0f;
+		p.rgba = (uint32_t)rand();
+	}
+}
+
+/* the kernels to check, skipping those this CPU or build lacks */
+static std::vector<const PointKernels *> simdKernels(){
+	std::vector<const PointKernels *> kernels;
+	for (size_t i = 0; i < sizeof(isa_names) / sizeof(isa_names[0]); i++){
+		const PointKernels *k = pointKernelsByName(isa_names[i]);
+		if (k)
+			kernels.push_back(k);
+	}
+	return kernels;
+}
+
+static void expectSamePoints(const PointT *expected, const PointT *actual, size_t size, float tolerance){
+	for (size_t i = 0; i < size; i++){
+		EXPECT_NEAR(expected[i].x, actual[i].x, tolerance) << "point " << i;
+		EXPECT_NEAR(expected[i].y, actual[i].y, tolerance) << "point " << i;
+		EXPECT_NEAR(expected[i].z, actual[i].z, tolerance) << "point " << i;
+		EXPECT_EQ(expected[i].data[3], actual[i].data[3]) << "point " << i;
+		EXPECT_EQ(expected[i].rgba, actual[i].rgba) << "point " << i;
+	}
+}
+
+TEST(PointKernels, PlaneDistanceRange)
+{
+	const PointKernels &scalar = scalarPointKernels();
+	std::vector<const PointKernels *> kernels = simdKernels();
+	std::vector<size_t> sizes = testSizes();
+	srand(1);
+	for (size_t s = 0; s < sizes.size(); s++){
+		PointCloudT cloud;
+		randomPoints(sizes[s], cloud);
+		const float plane[4] = {randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(0.5f, 1), randomFloat(-1, 1)};
+		const PointT *points = cloud.points.empty() ? NULL : &cloud.points[0];
+
+		float lo, hi;
+		scalar.plane_distance_range(points, sizes[s], plane, &lo, &hi);
+		for (size_t k = 0; k < kernels.size(); k++){
+			SCOPED_TRACE(kernels[k]->name);
+			SCOPED_TRACE(sizes[s]);
+			float simd_lo, simd_hi;
+			kernels[k]->plane_distance_range(points, sizes[s], plane, &simd_lo, &simd_hi);
+			if (sizes[s] == 0){
+				EXPECT_EQ(lo, simd_lo);
+				EXPECT_EQ(hi, simd_hi);
+			} else {
+				EXPECT_NEAR(lo, simd_lo, 1e-5f);
+				EXPECT_NEAR(hi, simd_hi, 1e-5f);
+			}
+		}
+	}
+}
+
+TEST(PointKernels, BoundingBox)
+{
+	const PointKernels &scalar = scalarPointKernels();
+	std::vector<const PointKernels *> kernels = simdKernels();
+	std::vector<size_t> sizes = testSizes();
+	srand(2);
+	for (size_t s = 0; s < sizes.size(); s++){
+		PointCloudT cloud;
+		randomPoints(sizes[s], cloud);
+		const PointT *points = cloud.points.empty() ? NULL : &cloud.points[0];
+
+		float min[3], max[3];
+		scalar.bounding_box(points, sizes[s], min, max);
+		for (size_t k = 0; k < kernels.size(); k++){
+			SCOPED_TRACE(kernels[k]->name);
+			SCOPED_TRACE(sizes[s]);
+			float simd_min[3], simd_max[3];
+			kernels[k]->bounding_box(points, sizes[s], simd_min, simd_max);
+			for (int d = 0; d < 3; d++){
+				EXPECT_EQ(min[d], simd_min[d]);
+				EXPECT_EQ(max[d], simd_max[d]);
+			}
+		}
+	}
+}
+
+TEST(PointKernels, ColourSums)
+{
+	const PointKernels &scalar = scalarPointKernels();
+	std::vector<const PointKernels *> kernels = simdKernels();
+	std::vector<size_t> sizes = testSizes();
+	srand(3);
+	for (size_t s = 0; s < sizes.size(); s++){
+		PointCloudT cloud;
+		randomPoints(sizes[s], cloud);
+		const PointT *points = cloud.points.empty() ? NULL : &cloud.points[0];
+
+		uint64_t sums[3];
+		scalar.colour_sums(points, sizes[s], sums);
+		for (size_t k = 0; k < kernels.size(); k++){
+			SCOPED_TRACE(kernels[k]->name);
+			SCOPED_TRACE(sizes[s]);
+			uint64_t simd_sums[3];
+			kernels[k]->colour_sums(points, sizes[s], simd_sums);
+			for (int c = 0; c < 3; c++)
+				EXPECT_EQ(sums[c], simd_sums[c]);
+		}
+	}
+}
+
+TEST(PointKernels, Crop)
+{
+	const PointKernels &scalar = scalarPointKernels();
+	std::vector<const PointKernels *> kernels = simdKernels();
+	std::vector<size_t> sizes = testSizes();
+	const float lo[3] = {-1.0f, -1.5f, 0.5f};
+	const float hi[3] = {1.0f, 1.5f, 3.0f};
+	srand(4);
+	for (size_t s = 0; s < sizes.size(); s++){
+		PointCloudT cloud;
+		randomPoints(sizes[s], cloud);
+		//points without a measurement are never inside
+		for (size_t i = 0; i < cloud.points.size(); i += 7)
+			cloud.points[i].z = std::numeric_limits<float>::quiet_NaN();
+		const PointT *points = cloud.points.empty() ? NULL : &cloud.points[0];
+
+		PointCloudT expected;
+		expected.points.resize(sizes[s] + 1);
+		size_t n = scalar.crop(points, sizes[s], lo, hi, &expected.points[0]);
+		for (size_t k = 0; k < kernels.size(); k++){
+			SCOPED_TRACE(kernels[k]->name);
+			SCOPED_TRACE(sizes[s]);
+			PointCloudT actual;
+			actual.points.resize(sizes[s] + 1);
+			ASSERT_EQ(n, kernels[k]->crop(points, sizes[s], lo, hi, &actual.points[0]));
+			expectSamePoints(&expected.points[0], &actual.points[0], n, 0.0f);
+
+			//in place
+			PointCloudT in_place = cloud;
+			PointT *data = in_place.points.empty() ? NULL : &in_place.points[0];
+			ASSERT_EQ(n, kernels[k]->crop(data, sizes[s], lo, hi, data));
+			expectSamePoints(&expected.points[0], data, n, 0.0f);
+		}
+	}
+}
+
+TEST(PointKernels, UnpackRgb)
+{
+	const PointKernels &scalar = scalarPointKernels();
+	std::vector<const PointKernels *> kernels = simdKernels();
+	std::vector<size_t> sizes = testSizes();
+	srand(5);
+	for (size_t s = 0; s < sizes.size(); s++){
+		PointCloudT cloud;
+		randomPoints(sizes[s], cloud);
+		const PointT *points = cloud.points.empty() ? NULL : &cloud.points[0];
+
+		//one spare byte catches writes past the end
+		std::vector<uint8_t> expected(3 * sizes[s] + 1, 0xab);
+		scalar.unpack_rgb(points, sizes[s], &expected[0]);
+		for (size_t k = 0; k < kernels.size(); k++){
+			SCOPED_TRACE(kernels[k]->name);
+			SCOPED_TRACE(sizes[s]);
+			std::vector<uint8_t> actual(3 * sizes[s] + 1, 0xab);
+			kernels[k]->unpack_rgb(points, sizes[s], &actual[0]);
+			EXPECT_EQ(expected, actual);
+		}
+	}
+}
+
+TEST(PointKernels, Transform)
+{
+	const PointKernels &scalar = scalarPointKernels();
+	std::vector<const PointKernels *> kernels = simdKernels();
+	std::vector<size_t> sizes = testSizes();
+	//a rotation about z and a translation
+	const float c = std::cos(0.3f), sn = std::sin(0.3f);
+	const float matrix[12] = {c, -sn, 0.0f, 0.1f,
+	                          sn, c, 0.0f, -0.2f,
+	                          0.0f, 0.0f, 1.0f, 0.7f};
+	srand(6);
+	for (size_t s = 0; s < sizes.size(); s++){
+		PointCloudT cloud;
+		randomPoints(sizes[s], cloud);
+		const PointT *points = cloud.points.empty() ? NULL : &cloud.points[0];
+
+		PointCloudT expected;
+		expected.points.resize(sizes[s] + 1);
+		scalar.transform(points, sizes[s], matrix, &expected.points[0]);
+		for (size_t k = 0; k < kernels.size(); k++){
+			SCOPED_TRACE(kernels[k]->name);
+			SCOPED_TRACE(sizes[s]);
+			PointCloudT actual;
+			actual.points.resize(sizes[s] + 1);
+			kernels[k]->transform(points, sizes[s], matrix, &actual.points[0]);
+			expectSamePoints(&expected.points[0], &actual.points[0], sizes[s], 1e-5f);
+
+			//in place
+			PointCloudT in_place = cloud;
+			PointT *data = in_place.points.empty() ? NULL : &in_place.points[0];
+			kernels[k]->transform(data, sizes[s], matrix, data);
+			expectSamePoints(&expected.points[0], data, sizes[s], 1e-5f);
+		}
+	}
+}
+
+TEST(PointKernels, Unproject)
+{
+	const PointKernels &scalar = scalarPointKernels();
+	std::vector<const PointKernels *> kernels = simdKernels();
+	std::vector<size_t> sizes = testSizes();
+	const float lo[3] = {-0.8f, -0.6f, 0.3f};
+	const float hi[3] = {0.8f, 0.6f, 2.5f};
+	srand(7);
+	for (size_t s = 0; s < sizes.size(); s++){
+		size_t n = sizes[s];
+		//one spare element keeps the pointers valid for empty inputs
+		std::vector<uint16_t> depth(n + 1);
+		std::vector<float> ray_x(n + 1), ray_y(n + 1);
+		std::vector<uint8_t> rgb(3 * n + 3);
+		for (size_t i = 0; i < n; i++){
+			//some pixels without depth
+			depth[i] = rand() % 5 == 0 ? 0 : (uint16_t)(rand() % 3000);
+			ray_x[i] = randomFloat(-0.6f, 0.6f);
+			ray_y[i] = randomFloat(-0.45f, 0.45f);
+		}
+		for (size_t i = 0; i < rgb.size(); i++)
+			rgb[i] = (uint8_t)rand();
+
+		for (int with_colour = 0; with_colour < 2; with_colour++){
+			const uint8_t *colour = with_colour ? &rgb[0] : NULL;
+			PointCloudT expected;
+			expected.points.resize(n + 1);
+			size_t count = scalar.unproject(&depth[0], &ray_x[0], &ray_y[0], n, 0.001f, colour, lo, hi,
+			                                &expected.points[0]);
+			for (size_t k = 0; k < kernels.size(); k++){
+				SCOPED_TRACE(kernels[k]->name);
+				SCOPED_TRACE(n);
+				SCOPED_TRACE(with_colour);
+				PointCloudT actual;
+				actual.points.resize(n + 1);
+				ASSERT_EQ(count, kernels[k]->unproject(&depth[0], &ray_x[0], &ray_y[0], n, 0.001f, colour, lo, hi,
+				                                       &actual.points[0]));
+				expectSamePoints(&expected.points[0], &actual.points[0], count, 1e-6f);
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
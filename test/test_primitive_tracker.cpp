@@ -0,0 +1,123 @@
+/*
+	Checks that PrimitiveTracker keeps the ids of shapes that stay put, keeps
+	every track through a partial detection (top-K, no plane) and only
+	removes the tracks of shapes that a complete detection no longer sees.
+*/
+
+#include <algorithm>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "bimur_robot_vision/collision_primitives.h"
+
+using namespace bimur_robot_vision;
+
+/*
+	Function: shapes()
+	Inputs  : const std::vector<float>&
+	Outputs : ObjectPrimitives
+	Purpose : untracked boxes standing at the given x positions
+*/
+static ObjectPrimitives shapes(const std::vector<float> &xs){
+	ObjectPrimitives out(xs.size());
+	for (size_t i = 0; i < xs.size(); i++){
+		out[i].id = -1;
+		out[i].cluster = i;
+		out[i].type = PRIMITIVE_BOX;
+		out[i].centre = Eigen::Vector3f(xs[i], 0.0f, 0.8f);
+		out[i].orientation = Eigen::Quaternionf::Identity();
+		out[i].dimensions = Eigen::Vector3f(0.05f, 0.05f, 0.1f);
+	}
+	return out;
+}
+
+static std::vector<int> ids(const ObjectPrimitives &primitives){
+	std::vector<int> out;
+	for (size_t i = 0; i < primitives.size(); i++)
+		out.push_back(primitives[i].id);
+	return out;
+}
+
+TEST(PrimitiveTracker, KeepsIdsOfShapesThatStayPut){
+	PrimitiveTracker tracker(0.05f);
+	std::vector<int> removed;
+	ObjectPrimitives first = shapes({0.0f, 0.2f, 0.4f});
+	tracker.update(first, removed);
+	EXPECT_TRUE(removed.empty());
+
+	//moved a little and listed in another order
+	ObjectPrimitives second = shapes({0.41f, 0.01f, 0.19f});
+	tracker.update(second, removed);
+	EXPECT_TRUE(removed.empty());
+	EXPECT_EQ(first[2].id, second[0].id);
+	EXPECT_EQ(first[0].id, second[1].id);
+	EXPECT_EQ(first[1].id, second[2].id);
+}
+
+TEST(PrimitiveTracker, PartialDetectionKeepsEveryTrack){
+	PrimitiveTracker tracker(0.05f);
+	std::vector<int> removed;
+	ObjectPrimitives complete = shapes({0.0f, 0.2f, 0.4f});
+	tracker.update(complete, removed);
+
+	//a top-1 detection that also moved the object it saw
+	ObjectPrimitives partial = shapes({0.22f});
+	tracker.match(partial);
+	EXPECT_EQ(complete[1].id, partial[0].id);
+
+	//the objects left out are still tracked where they were, the moved one where it went
+	ObjectPrimitives again = shapes({0.0f, 0.25f, 0.4f});
+	tracker.update(again, removed);
+	EXPECT_TRUE(removed.empty());
+	EXPECT_EQ(ids(complete), ids(again));
+}
+
+TEST(PrimitiveTracker, PartialDetectionStartsTracksForNewShapes){
+	PrimitiveTracker tracker(0.05f);
+	std::vector<int> removed;
+	ObjectPrimitives complete = shapes({0.0f, 0.2f});
+	tracker.update(complete, removed);
+
+	ObjectPrimitives partial = shapes({0.6f});
+	tracker.match(partial);
+	std::vector<int> known = ids(complete);
+	EXPECT_GE(partial[0].id, 0);
+	EXPECT_EQ(known.end(), std::find(known.begin(), known.end(), partial[0].id));
+
+	ObjectPrimitives again = shapes({0.0f, 0.2f, 0.6f});
+	tracker.update(again, removed);
+	EXPECT_TRUE(removed.empty());
+	EXPECT_EQ(partial[0].id, again[2].id);
+}
+
+TEST(PrimitiveTracker, CompleteDetectionAfterPartialRemovesStaleTracks){
+	PrimitiveTracker tracker(0.05f);
+	std::vector<int> removed;
+	ObjectPrimitives complete = shapes({0.0f, 0.2f, 0.4f});
+	tracker.update(complete, removed);
+
+	ObjectPrimitives partial = shapes({0.2f});
+	tracker.match(partial);
+
+	//the objects at 0.0 and 0.4 are gone
+	ObjectPrimitives after = shapes({0.2f});
+	tracker.update(after, removed);
+	EXPECT_EQ(complete[1].id, after[0].id);
+	std::sort(removed.begin(), removed.end());
+	std::vector<int> stale;
+	stale.push_back(complete[0].id);
+	stale.push_back(complete[2].id);
+	std::sort(stale.begin(), stale.end());
+	EXPECT_EQ(stale, removed);
+
+	//and stay gone
+	ObjectPrimitives later = shapes({0.2f});
+	tracker.update(later, removed);
+	EXPECT_TRUE(removed.empty());
+}
+
+int main(int argc, char **argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}